@@ -0,0 +1,73 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <time.h>
+
+#define DEADLINE_LATE_US 2000   // later wakeups than this are counted
+
+typedef enum {
+	OVERRUN_CATCHUP = 0,   // keep the absolute schedule, replay what was missed
+	OVERRUN_SKIP,          // jump straight to the current position
+	OVERRUN_COMPRESS,      // LED: squeeze the missed steps into what is left
+	OVERRUN_DROP           // audio: drop one period per cycle until caught up
+} OverrunPolicy;
+
+typedef enum {
+	DEADLINE_LATE = 0,     // woke late, no step/period boundary lost
+	DEADLINE_MISSED,       // at least one boundary passed while stalled
+	DEADLINE_XRUN,         // ALSA underrun
+	DEADLINE_KINDS
+} DeadlineKind;
+
+typedef struct {
+	const char *name;
+	OverrunPolicy policy;
+	unsigned long count[DEADLINE_KINDS];
+	unsigned long behind;  // boundaries passed in stalls (steps, PWM
+	                       // frames or audio periods)
+	long worst_late_us;
+
+	// Fault injection: one stall of fault_stall_ms at fault_at_ms
+	long fault_at_ms;
+	long fault_stall_ms;
+	int fault_fired;
+} DeadlineMonitor;
+
+extern DeadlineMonitor led_deadline;
+extern DeadlineMonitor audio_deadline;
+
+// "led=skip", "led=compress", "audio=drop", ...
+int deadline_set_policy(const char *spec);
+// "led:2000:300" stalls the LED thread for 300 ms, 2 s into the song
+int deadline_set_fault(const char *spec);
+
+void deadline_reset(void);
+void deadline_report(void);
+
+static inline void deadline_count(DeadlineMonitor *dm, DeadlineKind kind,
+				  long late_us) {
+	dm->count[kind]++;
+	if (late_us > dm->worst_late_us)
+		dm->worst_late_us = late_us;
+}
+
+// One stall that passed `behind` boundaries. A catch-up replay of them
+// is not counted again.
+static inline void deadline_stall(DeadlineMonitor *dm, long late_us,
+				  unsigned long behind) {
+	deadline_count(dm, DEADLINE_MISSED, late_us);
+	dm->behind += behind;
+}
+
+static inline void deadline_fault_point(DeadlineMonitor *dm, long elapsed_ms) {
+	if (dm->fault_stall_ms <= 0 || dm->fault_fired ||
+	    elapsed_ms < dm->fault_at_ms)
+		return;
+	dm->fault_fired = 1;
+	struct timespec stall = {
+		dm->fault_stall_ms / 1000, (dm->fault_stall_ms % 1000) * 1000000L
+	};
+	clock_nanosleep(CLOCK_MONOTONIC, 0, &stall, NULL);
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef DMX_H
+#define DMX_H
+
+#include <stdint.h>
+
+#define DMX_FRAME_HZ       40     // max frame rate on the wire, changes coalesce
+#define DMX_KEEPALIVE_MS   1000   // resend unchanged frames this often
+#define DMX_MAX_UNIVERSES  8
+#define DMX_SLOTS          512
+#define DMX_SENDER_PRIO    50     // below audio (75) and LED (80)
+
+#define E131_PORT   5568
+#define ARTNET_PORT 6454
+
+typedef enum {
+	DMX_NONE = 0,
+	DMX_E131,
+	DMX_ARTNET
+} DmxProtocol;
+
+// host == NULL: E1.31 multicast per universe / Art-Net broadcast.
+// Every universe carries the same 8 LED levels starting at start_channel.
+int dmx_open(DmxProtocol proto, const char *host,
+	     int first_universe, int universe_count, int start_channel);
+void dmx_close(void);
+
+void dmx_start(void);
+void dmx_stop(void);
+
+// Lock-free, safe to call from the RT LED thread.
+void dmx_publish(const uint8_t levels[8]);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define EVLOOP_MAX_TASKS 4
+#define EVLOOP_MAX_FDS   8
+
+// Cooperative task driven by file descriptor readiness. Among the tasks
+// that are ready, the one with the earliest deadline runs first.
+typedef struct EvTask {
+	const char *name;
+	int fds[EVLOOP_MAX_FDS];
+	uint32_t events[EVLOOP_MAX_FDS];    // epoll interest per fd
+	uint32_t revents[EVLOOP_MAX_FDS];   // filled in before ready()
+	int nfds;
+
+	struct timespec deadline;           // kept current by run()
+
+	int (*ready)(struct EvTask *t);     // 1 if the wakeup means work
+	int (*run)(struct EvTask *t);       // 0 once the task is finished
+	void *ctx;
+
+	int pending;
+	int done;
+	unsigned long runs;
+} EvTask;
+
+// Runs until every task has finished. Returns -1 if epoll fails.
+int evloop_run(EvTask **tasks, int count);
+
+#endif
@@ -1,18 +1,43 @@
-#ifndef LOAD_H
+﻿#ifndef LOAD_H
 #define LOAD_H
 
 #include <stdint.h>
 #include <stddef.h>
+#include <setjmp.h>
 
 #define MAX_PATTERNS 2048
 
 typedef struct {
+	uint64_t start_frame;  // absolute, in track samples
+	uint64_t end_frame;
+	double ideal_s;        // unrounded start on the authored timeline
 	int duration_ms;
 	uint8_t pattern;
+	uint8_t level[8];   // per-LED brightness, LED order as in led_lines
+	uint8_t fade;       // FadeCurve from the previous step's levels
+	int8_t sfx;         // effect sample fired at step start, -1 = none
+	uint8_t sfx_gain;   // percent
 } Pattern;
 
-extern Pattern patterns[MAX_PATTERNS];
+// The steps of the song being played (the installed set)
+extern Pattern *patterns;
 extern int pattern_count;
+extern int pattern_uses_pwm;   // any level other than 0/255, or any fade
+extern double pattern_end_ideal_s;
+
+// A parsed song's steps, loaded aside while another song plays
+typedef struct {
+    Pattern steps[MAX_PATTERNS];
+    int count;
+    int uses_pwm;
+    double end_ideal_s;
+} PatternSet;
+
+// Load the following songs into set (NULL: back to the default set,
+// which is installed as soon as it is loaded)
+void load_set_target(PatternSet *set);
+// Make set the steps the RT threads play; only while no song plays
+void pattern_set_install(const PatternSet *set);
 
 typedef struct {
     uint32_t sample_rate;
@@ -22,11 +47,27 @@ typedef struct {
     int16_t *pcm;         // PCM data pointer inside mmap
     void *mapping;        // base of mmap() region
     size_t mapping_size;  // total mapped file size
+
+    // Cue chunk and LIST/adtl body inside the mapping, NULL if absent
+    const uint8_t *cue;
+    uint32_t cue_size;
+    const uint8_t *adtl;
+    uint32_t adtl_size;
 } WavData;
 
+// Errors print a message and exit, or longjmp to the calling thread's
+// trap when one is set (batch preparation). NULL clears it.
+void load_set_trap(jmp_buf *trap);
+
 WavData load_wav_mmap(const char *filename);
 void free_wav_mmap(WavData *wav);
 
-void load_patterns(const char *filename);
+// .beat files are compiled from the beat grid, anything else is read as
+// a duration list. Positions are in samples at sample_rate.
+void load_patterns(const char *filename, uint32_t sample_rate);
+// Steps from LED cues embedded in the WAV. Returns the number of steps,
+// 0 if the file has no cue labelled with a pattern.
+int load_wav_cues(const WavData *wav);
+void report_pattern_timing(uint32_t sample_rate, size_t track_frames);
 
 #endif
@@ -7,6 +7,7 @@ void save_runtime_log(const char *filename,
 		      long *runtimes_us,
 		      long *wake_intervals_us,
 		      long *jitter_us,
+		      long *mix_us,
 		      size_t runtime_index,
 		      int underrun_count);
 
@@ -0,0 +1,40 @@
+#ifndef MIXER_H
+#define MIXER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "load.h"
+
+#define MIX_MAX_SAMPLES       16
+#define MIX_MAX_VOICES        8
+#define MIX_MAX_CHANNELS      2
+#define MIX_MAX_PERIOD_FRAMES 1024
+#define MIX_MAX_CUES          MAX_PATTERNS
+#define MIX_NAME_LEN          32
+
+#define SFX_GAIN_UNITY 32767   // Q15
+
+// Preload (mmap + mlock) every .wav in dir as an effect sample. Files
+// the loader rejects are skipped with a message.
+int mixer_load_dir(const char *dir);
+void mixer_unload(void);
+int mixer_find(const char *name);
+
+// Per song: drop effects that don't match the track format and turn the
+// pattern sfx events into a cue list in track frames.
+void mixer_bind(uint32_t sample_rate, uint16_t channels);
+
+// Lock-free, any thread. Starts at the next mixed period.
+int mixer_trigger(int sample, int16_t gain_q15);
+
+// Audio thread only. Returns the period to hand to ALSA: the track itself
+// when nothing plays, else the mix buffer. The same period asked for
+// again (rewritten after an underrun) returns the same mix.
+int mixer_needed(size_t frame_idx, size_t frames);
+const int16_t *mixer_mix(const int16_t *track, size_t frame_idx,
+			 size_t frames);
+
+void mixer_report(void);
+
+#endif
@@ -1,9 +1,33 @@
-#ifndef PLAYER_H
+﻿#ifndef PLAYER_H
 #define PLAYER_H
 
 #include <stdint.h>
+#include <time.h>
+
+#define MUSIC_BASE_DIR "/home/pi/music/"
+#define SFX_DIR MUSIC_BASE_DIR "sfx"
 
 void play_song(const char *base_name);
+void validate_song(const char *base_name);
 void reset_runtime_state(void);
+// Run LED timeline and audio feeder as tasks of one event-loop thread
+void player_set_single_thread(int enable);
+// Also write the per-cycle audio CSV after each song
+void player_set_csv_log(int enable);
+
+// Warm start: RT threads spawned once and parked, device kept open.
+// player_start() publishes the start time of the armed song, wakes the
+// threads and returns; -1 when nothing is armed or a song plays.
+// Arming during a song loads the next one, ready when the song ends.
+// Once player_done_fd() is readable, player_finish() reports the song.
+int player_warm_init(void);
+int player_arm(const char *base_name);
+const char *player_armed_song(void);
+int player_playing(void);
+int player_start(struct timespec trigger);
+void player_stop(void);
+int player_done_fd(void);
+void player_finish(void);
+void player_warm_shutdown(void);
 
 #endif
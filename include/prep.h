@@ -0,0 +1,18 @@
+#ifndef PREP_H
+#define PREP_H
+
+// Batch preparation of a music directory (-B): every song's WAV and
+// pattern file are validated, checksummed, compiled to the sample
+// timeline and scanned for peak/RMS envelopes. Results are written
+// atomically to <song>.prep next to the WAV. Songs whose files have the
+// same mtime, or the same content, as recorded there are skipped.
+#define PREP_EXT         ".prep"
+#define PREP_ENVELOPE_MS 100
+#define PREP_MAX_SONGS   1024
+#define PREP_MAX_WORKERS 64
+
+// jobs <= 0 uses one worker per online CPU. Returns the number of
+// songs that failed validation.
+int prep_library(const char *dir, int jobs);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef PWM_H
+#define PWM_H
+
+#include <stdint.h>
+
+// Binary code modulation: each refresh period is split into 8 bit-planes,
+// plane b lasting 2^b units. 200 Hz keeps the LSB at ~19.6 us.
+#define PWM_BITS        8
+#define PWM_REFRESH_HZ  200
+#define PWM_SPIN_NS     100000   // wake this early, then spin to the slot edge
+
+typedef enum {
+	FADE_NONE = 0,   // jump to the new levels at step start
+	FADE_LINEAR,
+	FADE_IN,         // quadratic ease-in
+	FADE_OUT,        // quadratic ease-out
+	FADE_SMOOTH      // smoothstep
+} FadeCurve;
+
+typedef struct {
+	uint32_t set_mask;
+	uint32_t clr_mask;
+	uint32_t duration_ns;
+} PwmSlot;
+
+// One brightness frame as timed register writes, longest slot first.
+typedef struct {
+	int count;
+	PwmSlot slot[PWM_BITS];
+} PwmFrame;
+
+uint32_t pwm_frame_ns(void);
+int pwm_parse_fade(const char *name);
+void pwm_fade_levels(uint8_t out[8], const uint8_t from[8], const uint8_t to[8],
+		     int curve, uint64_t pos, uint64_t len);
+void pwm_build_frame(PwmFrame *f, const uint8_t levels[8],
+		     const unsigned int *lines);
+
+#endif
@@ -7,6 +7,10 @@
 extern snd_pcm_t *pcm;
 
 void setup_alsa(unsigned int sample_rate, unsigned int channels);
+void alsa_ensure(unsigned int sample_rate, unsigned int channels);
+void alsa_rearm(void);
+int alsa_wake_at_delay(snd_pcm_uframes_t delay_frames);
+void alsa_wake_restore(void);
 void alsa_close(void);
 
 #endif
@@ -0,0 +1,86 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Live player state in POSIX shared memory for external monitors.
+// Every block has a single writer and its own sequence counter (odd while
+// the writer is inside), so the RT threads publish with plain stores and
+// never block; readers retry until they get a consistent copy.
+#define STATUS_SHM_NAME "/sequencer-status"
+#define STATUS_MAGIC    0x51455331u   // "1SEQ"
+#define STATUS_VERSION  1
+
+typedef struct {
+	uint32_t seq;
+	uint32_t playing;
+	char song[64];
+	uint32_t sample_rate;
+	uint64_t total_frames;
+	int32_t pattern_count;
+	int64_t start_ns;        // CLOCK_MONOTONIC of show start
+} __attribute__((aligned(64))) StatusShow;
+
+typedef struct {
+	uint32_t seq;
+	int32_t pattern_index;
+	int32_t jitter_us;       // latest wakeup lateness
+	uint32_t late, missed;
+	int64_t update_ns;
+} __attribute__((aligned(64))) StatusLed;
+
+typedef struct {
+	uint32_t seq;
+	uint64_t frame_pos;      // next frame handed to ALSA
+	int32_t alsa_delay;      // frames queued
+	int32_t jitter_us;
+	uint32_t underruns;
+	uint32_t late, missed;
+	int64_t update_ns;
+} __attribute__((aligned(64))) StatusAudio;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	StatusShow show;         // written by the main thread
+	StatusLed led;           // written by the LED thread
+	StatusAudio audio;       // written by the audio thread
+} StatusPage;
+
+// Never NULL: points to a private page when shared memory is unavailable
+extern StatusPage *status;
+
+int status_open(void);
+void status_close(void);
+void status_song_begin(const char *song, uint32_t sample_rate,
+                       uint64_t total_frames, int pattern_count,
+                       struct timespec start);
+void status_song_end(void);
+
+static inline void status_write_begin(uint32_t *seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void status_write_end(uint32_t *seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+// Consistent copy of one block; spins while a writer is inside
+static inline void status_read(const void *block, const uint32_t *seq,
+                               void *out, unsigned long size) {
+    uint32_t s1, s2;
+    do {
+        s1 = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+        __builtin_memcpy(out, block, size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(seq, __ATOMIC_RELAXED);
+    } while ((s1 & 1) || s1 != s2);
+}
+
+static inline int64_t status_ns(struct timespec t) {
+    return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+#endif
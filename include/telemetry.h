@@ -0,0 +1,78 @@
+﻿#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+// Append-only binary session telemetry. A file is a sequence of
+// sessions, one per song played:
+//
+//   TelSession header, TelRecord..., TelRecord of type TEL_END
+//
+// All fields little endian. A session cut short by a crash simply has
+// no TEL_END record. The RT threads push records into per-thread
+// lock-free rings; a background writer appends them to the file.
+#define TEL_MAGIC   "SEQT"
+#define TEL_VERSION 1
+#define TEL_DEFAULT_FILE "sequencer.tel"
+
+typedef enum {
+	TEL_MODE_THREADS = 0,   // LED thread + audio thread
+	TEL_MODE_EVENT,         // single event-loop thread (-1)
+	TEL_MODE_PWM            // PWM LED thread + audio thread
+} TelMode;
+
+typedef enum {
+	TEL_AUDIO = 1,          // one feeder cycle
+	TEL_LED,                // one LED step, also in PWM mode
+	TEL_END                 // session summary
+} TelType;
+
+#define TEL_F_MISSED   0x01   // a whole period/step boundary was lost
+#define TEL_F_UNDERRUN 0x02   // ALSA underrun in this cycle
+
+typedef struct {
+	char magic[4];
+	uint16_t version;
+	uint16_t record_size;   // sizeof(TelRecord)
+	int64_t wall_time;      // time() at show start
+	uint32_t sample_rate;
+	uint8_t mode;           // TelMode
+	uint8_t reserved[3];
+	char song[40];
+} TelSession;               // 64 bytes
+
+typedef struct {
+	uint32_t t_us;          // since show start
+	uint8_t type;           // TelType
+	uint8_t flags;
+	uint16_t arg;           // audio: ALSA delay frames, LED: step index
+	union {
+		int32_t jitter_us;  // TEL_AUDIO/TEL_LED: wakeup lateness
+		int32_t underruns;  // TEL_END: ALSA underruns of the show
+	};
+	uint16_t write_us;      // audio: writei calls, LED: register writes
+	uint16_t mix_us;        // audio: effect mixing
+} TelRecord;                // 16 bytes
+
+// TEL_END: t_us = show length, underruns = every ALSA underrun, also
+// those whose cycle record was dropped, arg = records dropped because
+// a ring was full (saturated)
+
+int telemetry_open(const char *path);
+void telemetry_close(void);
+
+// begin when the song is armed; start at show start stamps wall_time
+// and starts the writer, which puts the header in the file first
+void telemetry_begin(const char *song, uint32_t sample_rate, TelMode mode);
+void telemetry_start(void);
+void telemetry_end(uint32_t show_us, int underruns);
+// Session armed but never played (warm mode): never reaches the file
+void telemetry_cancel(void);
+
+// Called from the RT threads; never block, drop when the ring is full
+void tel_audio(uint32_t t_us, uint8_t flags, long delay_frames,
+               long jitter_us, long write_us, long mix_us);
+void tel_led(uint32_t t_us, uint8_t flags, int index,
+             long jitter_us, long write_us);
+
+#endif
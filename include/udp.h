@@ -5,8 +5,16 @@
 
 #define MAX_SONG_NAME 64
 #define UDP_PORT 5005
+#define UDP_CONTROL_PORT 5006
 
 int receive_udp_song(char *song_out, size_t len);
 void emulate_udp_from_file(const char *filename);
 
+// Live commands during playback, e.g. {"sfx":"hit","gain":80}
+void udp_control_start(void);
+void udp_control_stop(void);
+
+// Warm-start daemon (-W): arm/start commands on UDP_PORT until "quit"
+void udp_warm_daemon(const char *first_song);
+
 #endif
@@ -0,0 +1,75 @@
+﻿#include "deadline.h"
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+
+DeadlineMonitor led_deadline   = { .name = "LED" };
+DeadlineMonitor audio_deadline = { .name = "audio" };
+
+static const char *policy_names[] = { "catchup", "skip", "compress", "drop" };
+static const char *kind_names[] = { "late", "missed", "xrun" };
+
+static DeadlineMonitor *monitor_by_name(const char *name, size_t len) {
+    if (len == 3 && strncmp(name, "led", 3) == 0)   return &led_deadline;
+    if (len == 5 && strncmp(name, "audio", 5) == 0) return &audio_deadline;
+    return NULL;
+}
+
+int deadline_set_policy(const char *spec) {
+    const char *eq = strchr(spec, '=');
+    if (!eq) return -1;
+
+    DeadlineMonitor *dm = monitor_by_name(spec, eq - spec);
+    if (!dm) return -1;
+
+    for (int p = 0; p < 4; ++p) {
+        if (strcmp(eq + 1, policy_names[p]) != 0)
+            continue;
+        // Audio is not time-compressed, it can only drop periods
+        if ((p == OVERRUN_COMPRESS && dm == &audio_deadline) ||
+            (p == OVERRUN_DROP && dm == &led_deadline))
+            return -1;
+        dm->policy = (OverrunPolicy)p;
+        return 0;
+    }
+    return -1;
+}
+
+int deadline_set_fault(const char *spec) {
+    const char *colon = strchr(spec, ':');
+    if (!colon) return -1;
+
+    DeadlineMonitor *dm = monitor_by_name(spec, colon - spec);
+    if (!dm ||
+        sscanf(colon + 1, "%ld:%ld", &dm->fault_at_ms, &dm->fault_stall_ms) != 2)
+        return -1;
+    return 0;
+}
+
+void deadline_reset(void) {
+    DeadlineMonitor *all[] = { &led_deadline, &audio_deadline };
+    for (int i = 0; i < 2; ++i) {
+        memset(all[i]->count, 0, sizeof(all[i]->count));
+        all[i]->behind = 0;
+        all[i]->worst_late_us = 0;
+        all[i]->fault_fired = 0;
+    }
+}
+
+void deadline_report(void) {
+    DeadlineMonitor *all[] = { &led_deadline, &audio_deadline };
+    for (int i = 0; i < 2; ++i) {
+        const DeadlineMonitor *dm = all[i];
+        char line[160];
+        int n = snprintf(line, sizeof(line), "%s deadlines (%s):",
+                         dm->name, policy_names[dm->policy]);
+        for (int k = 0; k < DEADLINE_KINDS; ++k)
+            n += snprintf(line + n, sizeof(line) - n, " %s %lu,",
+                          kind_names[k], dm->count[k]);
+        snprintf(line + n, sizeof(line) - n, " behind %lu, worst %ld us",
+                 dm->behind, dm->worst_late_us);
+
+        printf("%s\n", line);
+        syslog(LOG_INFO, "%s\n", line);
+    }
+}
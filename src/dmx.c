@@ -0,0 +1,346 @@
+﻿#define _GNU_SOURCE
+#include "dmx.h"
+#include "status.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define E131_HEADER_LEN   126
+#define ARTNET_HEADER_LEN 18
+
+// --------------------------------------------------------------
+// Sink state
+// --------------------------------------------------------------
+static DmxProtocol dmx_proto = DMX_NONE;
+static int dmx_sock = -1;
+static int dmx_universes = 0;
+static int dmx_channel_offset = 0;   // byte offset of LED 0 in each packet
+static size_t dmx_packet_len = 0;
+
+static uint8_t packets[DMX_MAX_UNIVERSES][E131_HEADER_LEN + DMX_SLOTS];
+static struct sockaddr_in dests[DMX_MAX_UNIVERSES];
+static struct iovec iovs[DMX_MAX_UNIVERSES];
+static struct mmsghdr msgs[DMX_MAX_UNIVERSES];
+static uint8_t sequence = 0;
+
+// Written by the LED thread under the pub_gen seqlock (odd while it
+// writes), read by the sender. 32-bit words only: the Pi 1 has no
+// lock-free 64-bit atomics.
+static struct {
+    uint32_t levels[2];
+    uint32_t time_lo, time_hi;
+} pub;
+static uint32_t pub_gen = 0;
+
+static pthread_t sender_thread;
+static int sender_running = 0;
+// Last generation of the previous song: a sender started after the LED
+// thread still picks up the frames published before it ran
+static uint32_t sent_gen = 0;
+
+// Statistics, per song
+static unsigned long frames_sent = 0;
+static unsigned long changes_sent = 0;
+static unsigned long changes_coalesced = 0;
+static uint64_t latency_sum_ns = 0;
+static uint64_t latency_max_ns = 0;
+
+// --------------------------------------------------------------
+// Packet templates
+// --------------------------------------------------------------
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, v >> 16);
+    put16(p + 2, v & 0xffff);
+}
+
+static void build_e131(uint8_t *p, int universe) {
+    static const char acn_id[12] = "ASC-E1.17\0\0";
+    const uint16_t len = E131_HEADER_LEN + DMX_SLOTS;
+
+    memset(p, 0, len);
+    // Root layer
+    put16(p + 0, 0x0010);
+    memcpy(p + 4, acn_id, sizeof(acn_id));
+    put16(p + 16, 0x7000 | (len - 16));
+    put32(p + 18, 0x00000004);
+    // CID: FNV-1a of the host name, so receivers see a stable source
+    char name[64] = "sequencer";
+    gethostname(name, sizeof(name) - 1);
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < 16; ++i) {
+        for (const char *c = name; *c; ++c)
+            h = (h ^ (uint8_t)*c) * 16777619u;
+        h = (h ^ i) * 16777619u;
+        p[22 + i] = h & 0xff;
+    }
+    // Framing layer
+    put16(p + 38, 0x7000 | (len - 38));
+    put32(p + 40, 0x00000002);
+    snprintf((char *)p + 44, 64, "sequencer");
+    p[108] = 100;                                // priority
+    put16(p + 113, universe);
+    // DMP layer
+    put16(p + 115, 0x7000 | (len - 115));
+    p[117] = 0x02;
+    p[118] = 0xa1;
+    put16(p + 121, 0x0001);
+    put16(p + 123, DMX_SLOTS + 1);
+    p[125] = 0x00;                               // DMX start code
+}
+
+static void build_artnet(uint8_t *p, int universe) {
+    memset(p, 0, ARTNET_HEADER_LEN + DMX_SLOTS);
+    memcpy(p, "Art-Net", 8);
+    p[8] = 0x00;                                 // OpDmx, little endian
+    p[9] = 0x50;
+    put16(p + 10, 14);                           // protocol version
+    p[14] = universe & 0xff;                     // SubUni
+    p[15] = (universe >> 8) & 0x7f;              // Net
+    put16(p + 16, DMX_SLOTS);
+}
+
+// --------------------------------------------------------------
+// Setup
+// --------------------------------------------------------------
+int dmx_open(DmxProtocol proto, const char *host,
+             int first_universe, int universe_count, int start_channel) {
+    if (universe_count < 1 || universe_count > DMX_MAX_UNIVERSES ||
+        start_channel < 1 || start_channel + 7 > DMX_SLOTS) {
+        fprintf(stderr, "DMX: bad universe/channel configuration\n");
+        return -1;
+    }
+
+    // E1.31 reserves 0 and 64000+; Art-Net has a 15-bit port address
+    const int lowest  = (proto == DMX_E131) ? 1 : 0;
+    const int highest = (proto == DMX_E131) ? 63999 : 32767;
+    const int last_universe = first_universe + universe_count - 1;
+    if (first_universe < lowest || last_universe > highest) {
+        fprintf(stderr, "DMX: universes %d..%d outside %d..%d\n",
+                first_universe, last_universe, lowest, highest);
+        return -1;
+    }
+
+    // One unicast host for all universes, else multicast/broadcast
+    struct in_addr host_addr;
+    if (host && inet_pton(AF_INET, host, &host_addr) != 1) {
+        fprintf(stderr, "DMX: bad host address '%s'\n", host);
+        return -1;
+    }
+
+    dmx_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (dmx_sock < 0) { perror("DMX socket"); return -1; }
+
+    int one = 1;
+    setsockopt(dmx_sock, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+
+    const int header = (proto == DMX_E131) ? E131_HEADER_LEN
+                                           : ARTNET_HEADER_LEN;
+    dmx_packet_len = header + DMX_SLOTS;
+    dmx_channel_offset = header + start_channel - 1;
+
+    for (int u = 0; u < universe_count; ++u) {
+        int universe = first_universe + u;
+        struct sockaddr_in *d = &dests[u];
+
+        memset(d, 0, sizeof(*d));
+        d->sin_family = AF_INET;
+        if (proto == DMX_E131) {
+            build_e131(packets[u], universe);
+            d->sin_port = htons(E131_PORT);
+            if (host)
+                d->sin_addr = host_addr;
+            else
+                d->sin_addr.s_addr = htonl(0xefff0000u | (universe & 0xffff));
+        } else {
+            build_artnet(packets[u], universe);
+            d->sin_port = htons(ARTNET_PORT);
+            if (host)
+                d->sin_addr = host_addr;
+            else
+                d->sin_addr.s_addr = htonl(INADDR_BROADCAST);
+        }
+
+        iovs[u].iov_base = packets[u];
+        iovs[u].iov_len  = dmx_packet_len;
+        memset(&msgs[u], 0, sizeof(msgs[u]));
+        msgs[u].msg_hdr.msg_name    = d;
+        msgs[u].msg_hdr.msg_namelen = sizeof(*d);
+        msgs[u].msg_hdr.msg_iov     = &iovs[u];
+        msgs[u].msg_hdr.msg_iovlen  = 1;
+    }
+
+    dmx_proto = proto;
+    sequence = (proto == DMX_ARTNET) ? 1 : 0;
+    dmx_universes = universe_count;
+    syslog(LOG_INFO, "DMX sink: %s, universes %d..%d, channel %d\n",
+           proto == DMX_E131 ? "E1.31" : "Art-Net",
+           first_universe, first_universe + universe_count - 1,
+           start_channel);
+    return 0;
+}
+
+void dmx_close(void) {
+    if (dmx_sock >= 0)
+        close(dmx_sock);
+    dmx_sock = -1;
+    dmx_proto = DMX_NONE;
+}
+
+// --------------------------------------------------------------
+// Publish (LED thread side)
+// --------------------------------------------------------------
+static uint64_t now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+void dmx_publish(const uint8_t levels[8]) {
+    if (dmx_proto == DMX_NONE)
+        return;
+
+    uint64_t t = now_ns();
+    status_write_begin(&pub_gen);
+    memcpy(pub.levels, levels, 8);
+    pub.time_lo = (uint32_t)t;
+    pub.time_hi = (uint32_t)(t >> 32);
+    status_write_end(&pub_gen);
+}
+
+// --------------------------------------------------------------
+// Sender thread
+// --------------------------------------------------------------
+static void send_frame(uint64_t packed) {
+    uint8_t levels[8];
+    memcpy(levels, &packed, 8);
+
+    // Only the sequence number and the payload change between frames
+    const int seq_offset = (dmx_proto == DMX_E131) ? 111 : 12;
+    for (int u = 0; u < dmx_universes; ++u) {
+        packets[u][seq_offset] = sequence;
+        memcpy(&packets[u][dmx_channel_offset], levels, 8);
+    }
+    // Art-Net reads sequence 0 as "sequencing disabled"
+    sequence++;
+    if (dmx_proto == DMX_ARTNET && sequence == 0)
+        sequence = 1;
+
+    int sent = 0;
+    while (sent < dmx_universes) {
+        int n = sendmmsg(dmx_sock, msgs + sent, dmx_universes - sent, 0);
+        if (n < 0) {
+            syslog(LOG_WARNING, "DMX sendmmsg: %m\n");
+            break;
+        }
+        sent += n;
+    }
+    frames_sent++;
+}
+
+static void *dmx_sender_fn(void *arg) {
+    const long interval_ns = 1000000000L / DMX_FRAME_HZ;
+    uint32_t last_gen = sent_gen;
+    uint64_t last_levels = 0;
+    uint64_t last_send_ns = 0;
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (__atomic_load_n(&sender_running, __ATOMIC_ACQUIRE)) {
+        uint32_t gen = __atomic_load_n(&pub_gen, __ATOMIC_ACQUIRE);
+        uint64_t t = now_ns();
+
+        if (gen != last_gen) {
+            // Levels and time of one publish: retry while it is written
+            uint64_t levels, pub_ns;
+            uint32_t check;
+            do {
+                gen = __atomic_load_n(&pub_gen, __ATOMIC_ACQUIRE);
+                memcpy(&levels, pub.levels, 8);
+                pub_ns = (uint64_t)pub.time_hi << 32 | pub.time_lo;
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                check = __atomic_load_n(&pub_gen, __ATOMIC_RELAXED);
+            } while ((gen & 1) || gen != check);
+
+            changes_coalesced += (gen - last_gen) / 2 - 1;
+            last_gen = gen;
+            last_levels = levels;
+
+            send_frame(levels);
+            last_send_ns = now_ns();
+            changes_sent++;
+
+            uint64_t lat = last_send_ns > pub_ns ? last_send_ns - pub_ns : 0;
+            latency_sum_ns += lat;
+            if (lat > latency_max_ns) latency_max_ns = lat;
+
+        } else if (t - last_send_ns >= DMX_KEEPALIVE_MS * 1000000ull) {
+            send_frame(last_levels);
+            last_send_ns = t;
+        }
+
+        next.tv_nsec += interval_ns;
+        while (next.tv_nsec >= 1000000000) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+
+    // The song is over: nothing it published is left to send
+    sent_gen = __atomic_load_n(&pub_gen, __ATOMIC_ACQUIRE);
+    // Blackout so fixtures don't hold the last look
+    send_frame(0);
+    return NULL;
+}
+
+void dmx_start(void) {
+    if (dmx_proto == DMX_NONE)
+        return;
+
+    frames_sent = changes_sent = changes_coalesced = 0;
+    latency_sum_ns = latency_max_ns = 0;
+    __atomic_store_n(&sender_running, 1, __ATOMIC_RELEASE);
+
+    struct sched_param param = {.sched_priority = DMX_SENDER_PRIO};
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+
+    pthread_create(&sender_thread, &attr, dmx_sender_fn, NULL);
+    pthread_attr_destroy(&attr);
+}
+
+void dmx_stop(void) {
+    if (dmx_proto == DMX_NONE)
+        return;
+
+    __atomic_store_n(&sender_running, 0, __ATOMIC_RELEASE);
+    pthread_join(sender_thread, NULL);
+
+    double avg_ms = changes_sent ?
+        latency_sum_ns / 1e6 / changes_sent : 0.0;
+    syslog(LOG_INFO, "DMX: %lu frames, %lu changes, %lu coalesced, "
+           "latency avg %.2f ms max %.2f ms\n",
+           frames_sent, changes_sent, changes_coalesced,
+           avg_ms, latency_max_ns / 1e6);
+    printf("DMX: %lu frames sent, %lu changes (%lu coalesced), "
+           "change->wire avg %.2f ms, max %.2f ms\n",
+           frames_sent, changes_sent, changes_coalesced,
+           avg_ms, latency_max_ns / 1e6);
+}
@@ -0,0 +1,101 @@
+﻿#include "evloop.h"
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+static int earlier(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec ||
+           (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void task_finish(int ep, EvTask *t) {
+    t->done = 1;
+    t->pending = 0;
+    for (int f = 0; f < t->nfds; ++f)
+        epoll_ctl(ep, EPOLL_CTL_DEL, t->fds[f], NULL);
+}
+
+int evloop_run(EvTask **tasks, int count) {
+    if (count > EVLOOP_MAX_TASKS)
+        return -1;
+
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    if (ep < 0) {
+        perror("epoll_create1");
+        return -1;
+    }
+
+    int active = count;
+    for (int i = 0; i < count; ++i) {
+        EvTask *t = tasks[i];
+        t->pending = t->done = 0;
+        t->runs = 0;
+        for (int f = 0; f < t->nfds; ++f) {
+            // Task and fd index packed into the event cookie
+            struct epoll_event ev = {
+                .events = t->events[f],
+                .data.u32 = (uint32_t)(i << 8 | f)
+            };
+            if (epoll_ctl(ep, EPOLL_CTL_ADD, t->fds[f], &ev) < 0) {
+                perror("epoll_ctl");
+                close(ep);
+                return -1;
+            }
+        }
+    }
+
+    while (active > 0) {
+        struct epoll_event ev[EVLOOP_MAX_TASKS * EVLOOP_MAX_FDS];
+        int n = epoll_wait(ep, ev, sizeof(ev) / sizeof(ev[0]), -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            close(ep);
+            return -1;
+        }
+
+        for (int i = 0; i < count; ++i)
+            for (int f = 0; f < tasks[i]->nfds; ++f)
+                tasks[i]->revents[f] = 0;
+
+        for (int k = 0; k < n; ++k) {
+            EvTask *t = tasks[ev[k].data.u32 >> 8];
+            t->revents[ev[k].data.u32 & 0xFF] = ev[k].events;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            EvTask *t = tasks[i];
+            int woken = 0;
+            for (int f = 0; f < t->nfds; ++f)
+                woken |= t->revents[f] != 0;
+            if (woken && !t->done && t->ready(t))
+                t->pending = 1;
+        }
+
+        // Earliest deadline first; a task that finished its work may
+        // let a later one through before the next epoll_wait.
+        for (;;) {
+            EvTask *next = NULL;
+            for (int i = 0; i < count; ++i) {
+                EvTask *t = tasks[i];
+                if (t->pending && (!next || earlier(&t->deadline,
+                                                    &next->deadline)))
+                    next = t;
+            }
+            if (!next)
+                break;
+
+            next->pending = 0;
+            next->runs++;
+            if (!next->run(next)) {
+                task_finish(ep, next);
+                active--;
+            }
+        }
+    }
+
+    close(ep);
+    return 0;
+}
@@ -1,8 +1,12 @@
 ﻿#include "load.h"
+#include "pwm.h"
+#include "mixer.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <math.h>
+#include <setjmp.h>
 
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -29,10 +33,76 @@ typedef struct {
     uint16_t block_align;
     uint16_t bits_per_sample;
 } FmtChunk;
+
+typedef struct {
+    uint32_t id;
+    uint32_t position;
+    char     chunk_id[4];    // "data"
+    uint32_t chunk_start;
+    uint32_t block_start;
+    uint32_t sample_offset;  // frame in the data chunk
+} CuePoint;
+
+typedef struct {
+    uint32_t cue_id;
+    uint32_t sample_length;
+    char     purpose[4];     // "rgn " for regions
+    uint16_t country, language, dialect, code_page;
+} LtxtHeader;
 #pragma pack(pop)
 
-Pattern patterns[MAX_PATTERNS];
+// The loaders fill load_out. The default set becomes the show's steps
+// as soon as it is loaded; any other set only once it is installed, so
+// a song can be parsed while another one plays.
+static PatternSet default_set;
+static PatternSet *load_out = &default_set;
+
+Pattern *patterns = default_set.steps;
 int pattern_count = 0;
+int pattern_uses_pwm = 0;
+double pattern_end_ideal_s = 0.0;
+
+void load_set_target(PatternSet *set) {
+    load_out = set ? set : &default_set;
+}
+
+void pattern_set_install(const PatternSet *set) {
+    patterns = (Pattern *)set->steps;
+    pattern_count = set->count;
+    pattern_uses_pwm = set->uses_pwm;
+    pattern_end_ideal_s = set->end_ideal_s;
+}
+
+static void loaded(void) {
+    if (load_out == &default_set)
+        pattern_set_install(&default_set);
+}
+
+// Batch preparation checks many songs in one process: with a trap set,
+// load errors unwind to it instead of ending the program.
+static __thread jmp_buf *load_trap;
+static __thread FILE *load_file;
+
+void load_set_trap(jmp_buf *trap) {
+    load_trap = trap;
+}
+
+__attribute__((noreturn)) static void load_fail(void) {
+    if (load_file) {
+        fclose(load_file);
+        load_file = NULL;
+    }
+    if (load_trap)
+        longjmp(*load_trap, 1);
+    exit(1);
+}
+
+__attribute__((noreturn))
+static void wav_fail(void *mapping, size_t size, const char *msg) {
+    fprintf(stderr, "%s\n", msg);
+    munmap(mapping, size);
+    load_fail();
+}
 
 WavData load_wav_mmap(const char *filename)
 {
@@ -40,17 +110,22 @@ WavData load_wav_mmap(const char *filename)
 
 	// --- open file ---
 	int fd = open(filename, O_RDONLY);
-	if (fd < 0) { perror("open WAV"); exit(1); }
+	if (fd < 0) { perror("open WAV"); load_fail(); }
 
 	// --- get file size ---
 	struct stat st;
-	if (fstat(fd, &st) < 0) { perror("fstat"); exit(1); }
+	if (fstat(fd, &st) < 0) { perror("fstat"); close(fd); load_fail(); }
 	size_t file_size = st.st_size;
+	if (file_size < sizeof(RiffHeader)) {
+	    fprintf(stderr, "Not a RIFF/WAVE file\n");
+	    close(fd);
+	    load_fail();
+	}
 
 	// --- mmap whole file ---
 	void *mapping = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
 	close(fd);
-	if (mapping == MAP_FAILED) { perror("mmap"); exit(1); }
+	if (mapping == MAP_FAILED) { perror("mmap"); load_fail(); }
 
 	out.mapping = mapping;
 	out.mapping_size = file_size;
@@ -60,10 +135,8 @@ WavData load_wav_mmap(const char *filename)
 	// --- parse RIFF header ---
 	RiffHeader *riff = (RiffHeader *)p;
 	if (memcmp(riff->riff_id, "RIFF", 4) != 0 ||
-	    memcmp(riff->wave_id, "WAVE", 4) != 0) {
-	    fprintf(stderr, "Not a RIFF/WAVE file\n");
-	    exit(1);
-	}
+	    memcmp(riff->wave_id, "WAVE", 4) != 0)
+	    wav_fail(mapping, file_size, "Not a RIFF/WAVE file");
 
 	p += sizeof(RiffHeader);
 
@@ -72,30 +145,43 @@ WavData load_wav_mmap(const char *filename)
 	uint8_t *data_ptr = NULL;
 
 	// --- walk chunks ---
-	while (p < (uint8_t *)mapping + file_size) {
+	// Cue and label chunks often follow the audio, so walk the whole file
+	uint8_t *file_end = (uint8_t *)mapping + file_size;
+	while (p + sizeof(ChunkHeader) <= file_end) {
 	    ChunkHeader *ch = (ChunkHeader *)p;
+	    uint8_t *body = p + sizeof(ChunkHeader);
+	    uint32_t size = ch->chunk_size;
+	    if (size > (size_t)(file_end - body))
+	        size = file_end - body;   // truncated or streamed file
 
 	    if (memcmp(ch->chunk_id, "fmt ", 4) == 0) {
-                memcpy(&fmt, p + sizeof(ChunkHeader), sizeof(FmtChunk));
+                memcpy(&fmt, body, sizeof(FmtChunk));
 
 	    } else if (memcmp(ch->chunk_id, "data", 4) == 0) {
-	        data_size = ch->chunk_size;
-		data_ptr = p + sizeof(ChunkHeader);
-		break;
+	        data_size = size;
+		data_ptr = body;
+
+	    } else if (memcmp(ch->chunk_id, "cue ", 4) == 0 && size >= 4) {
+	        out.cue = body;
+	        out.cue_size = size;
+
+	    } else if (memcmp(ch->chunk_id, "LIST", 4) == 0 && size >= 4 &&
+	               memcmp(body, "adtl", 4) == 0) {
+	        out.adtl = body + 4;
+	        out.adtl_size = size - 4;
 	    }
 
-	    p += sizeof(ChunkHeader) + ch->chunk_size;
+	    // Chunks are word aligned
+	    p = body + size + (size & 1);
 	}
 
-	if (!data_ptr) {
-		fprintf(stderr, "No data chunk found\n");
-		exit(1);
-	}
+	if (!data_ptr)
+		wav_fail(mapping, file_size, "No data chunk found");
 
-	if (fmt.audio_format != 1 || fmt.bits_per_sample != 16) {
-	    fprintf(stderr, "Unsupported WAV format (need PCM 16-bit)\n");
-	    exit(1);
-	}
+	if (fmt.audio_format != 1 || fmt.bits_per_sample != 16 ||
+	    fmt.num_channels == 0 || fmt.sample_rate == 0)
+	    wav_fail(mapping, file_size,
+	             "Unsupported WAV format (need PCM 16-bit)");
 
         // --- fill output struct ---
 	out.sample_rate = fmt.sample_rate;
@@ -114,30 +200,567 @@ void free_wav_mmap(WavData *wav)
     memset(wav, 0, sizeof(*wav));
 }
 
-void load_patterns(const char *filename) {
-    FILE *f = fopen(filename, "r");
-    if (!f) { perror("pattern open"); exit(1); }
+static int hex_nibble(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// "1010.1100" -> on/off, "@ff80400000000000" -> 8 hex brightness bytes
+static int parse_levels(const char *bits, Pattern *pat) {
+    if (bits[0] == '@') {
+        if (strlen(bits + 1) != 16) return -1;
+        for (int j = 0; j < 8; ++j) {
+            int hi = hex_nibble(bits[1 + 2 * j]);
+            int lo = hex_nibble(bits[2 + 2 * j]);
+            if (hi < 0 || lo < 0) return -1;
+            pat->level[j] = (uint8_t)((hi << 4) | lo);
+        }
+    } else {
+        uint8_t p = 0;
+        for (int i = 0, j = 0; i < 8 && bits[j]; ++j) {
+            if (bits[j] == '.') continue;
+            p = (p << 1) | (bits[j] == '1' ? 1 : 0);
+            ++i;
+        }
+        for (int j = 0; j < 8; ++j)
+            pat->level[j] = ((p >> (7 - j)) & 1) ? 255 : 0;
+    }
+
+    pat->pattern = 0;
+    for (int j = 0; j < 8; ++j)
+        pat->pattern |= (pat->level[j] >= 128 ? 1 : 0) << (7 - j);
+    return 0;
+}
+
+// Fade / sfx tokens after the pattern. Continues the caller's strtok().
+static void parse_step_options(Pattern *pat) {
+    char *tok;
+    while ((tok = strtok(NULL, " \t\r\n")) != NULL) {
+        if (tok[0] == '#')
+            break;
+        if (strncmp(tok, "sfx:", 4) == 0) {
+            char *gain = strchr(tok + 4, ':');
+            if (gain) *gain++ = '\0';
+            pat->sfx = (int8_t)mixer_find(tok + 4);
+            int pct = gain ? atoi(gain) : 100;
+            pat->sfx_gain = (uint8_t)(pct < 0 ? 0 : pct > 100 ? 100 : pct);
+            if (pat->sfx < 0)
+                fprintf(stderr, "Unknown sfx '%s', ignored\n", tok + 4);
+            continue;
+        }
+        int curve = pwm_parse_fade(tok);
+        if (curve < 0) {
+            fprintf(stderr, "Unknown fade '%s', using step\n", tok);
+            curve = FADE_NONE;
+        }
+        pat->fade = (uint8_t)curve;
+    }
+}
+
+static void add_pattern(const Pattern *pat) {
+    if (pat->fade != FADE_NONE)
+        load_out->uses_pwm = 1;
+    for (int j = 0; j < 8; ++j)
+        if (pat->level[j] != 0 && pat->level[j] != 255)
+            load_out->uses_pwm = 1;
+
+    load_out->steps[load_out->count++] = *pat;
+}
 
-    char line[64];
-    pattern_count = 0;
+// --------------------------------------------------------------
+// Duration list (.txt): [duration_ms] [pattern] [options]
+// --------------------------------------------------------------
+static void load_duration_patterns(FILE *f, uint32_t sample_rate) {
+    char line[128];
+    uint64_t start_ms = 0;
+    double ideal_s = 0.0;
 
     while (fgets(line, sizeof(line), f)) {
-        if (pattern_count >= MAX_PATTERNS) {
+        if (load_out->count >= MAX_PATTERNS) {
             fprintf(stderr, "Too many patterns!\n");
             break;
         }
-        int dur; char bits[10];
-        if (sscanf(line, "%d %9s", &dur, bits) == 2) {
-            if (dur < 70) dur = 70;
-            dur = ((dur + 5) / 10) * 10;
-            uint8_t p = 0;
-            for (int i = 0, j = 0; i < 8 && bits[j]; ++j) {
-                if (bits[j] == '.') continue;
-                p = (p << 1) | (bits[j] == '1' ? 1 : 0);
-                ++i;
+        char *tok = strtok(line, " \t\r\n");
+        if (!tok) continue;
+        char *end;
+        int dur = (int)strtol(tok, &end, 10);
+        if (end == tok) continue;
+        char *bits = strtok(NULL, " \t\r\n");
+        if (!bits) continue;
+
+        Pattern pat = {0};
+        pat.sfx = -1;
+        if (parse_levels(bits, &pat) != 0) {
+            fprintf(stderr, "Bad pattern '%s', skipped\n", bits);
+            continue;
+        }
+        parse_step_options(&pat);
+
+        pat.ideal_s = ideal_s;
+        ideal_s += dur / 1000.0;
+
+        if (dur < 70) dur = 70;
+        dur = ((dur + 5) / 10) * 10;
+        pat.duration_ms = dur;
+
+        // Rounded durations are whole 10 ms, exact at 44.1/48 kHz
+        pat.start_frame = start_ms * sample_rate / 1000;
+        start_ms += dur;
+        pat.end_frame = start_ms * sample_rate / 1000;
+
+        add_pattern(&pat);
+    }
+    load_out->end_ideal_s = ideal_s;
+}
+
+// --------------------------------------------------------------
+// Beat grid (.beat): positions in bar:beat, compiled through the
+// tempo map into absolute sample positions. Every position is converted
+// on its own, so rounding never accumulates.
+// --------------------------------------------------------------
+#define MAX_MAP_EVENTS 256
+
+typedef struct { int bar; int beats; } MeterEvent;     // from bar on
+typedef struct {
+    int bar;
+    double bar_beat;     // as written
+    double beat;         // absolute, filled in once the meter map is known
+    double bpm;
+    int line;            // for error messages
+} TempoEvent;
+
+static MeterEvent meters[MAX_MAP_EVENTS];
+static TempoEvent tempos[MAX_MAP_EVENTS];
+static int meter_count, tempo_count;
+static double beat_offset_s;
+
+__attribute__((noreturn))
+static void beat_error(const char *file, int line, const char *msg) {
+    fprintf(stderr, "%s:%d: %s\n", file, line, msg);
+    load_fail();
+}
+
+// Errors that belong to the file as a whole, not to one line
+__attribute__((noreturn))
+static void beat_file_error(const char *file, const char *msg) {
+    fprintf(stderr, "%s: %s\n", file, msg);
+    load_fail();
+}
+
+// "bar:beat", both 1-based, beat may be fractional ("12:2.5")
+static int parse_position(const char *s, int *bar, double *beat) {
+    char *end;
+    *bar = (int)strtol(s, &end, 10);
+    if (end == s || *end != ':' || *bar < 1) return -1;
+    const char *b = end + 1;
+    *beat = strtod(b, &end);
+    if (end == b || *end != '\0' || *beat < 1.0) return -1;
+    return 0;
+}
+
+static int meter_at(int bar) {
+    int beats = meters[0].beats;
+    for (int i = 1; i < meter_count && meters[i].bar <= bar; ++i)
+        beats = meters[i].beats;
+    return beats;
+}
+
+// A beat past the bar's meter would silently land in a later bar
+static int beat_in_bar(int bar, double beat) {
+    return beat < meter_at(bar) + 1.0;
+}
+
+static double position_to_beats(int bar, double beat) {
+    double beats = 0.0;
+    int at_bar = 1;
+    for (int i = 0; i < meter_count; ++i) {
+        int until = (i + 1 < meter_count && meters[i + 1].bar < bar)
+                    ? meters[i + 1].bar : bar;
+        if (until > at_bar) {
+            beats += (double)(until - at_bar) * meters[i].beats;
+            at_bar = until;
+        }
+    }
+    return beats + (beat - 1.0);
+}
+
+static double beats_to_seconds(double beats) {
+    double t = beat_offset_s;
+    for (int i = 0; i < tempo_count; ++i) {
+        double seg_end = (i + 1 < tempo_count) ? tempos[i + 1].beat : beats;
+        if (seg_end > beats) seg_end = beats;
+        if (seg_end <= tempos[i].beat) break;
+        t += (seg_end - tempos[i].beat) * 60.0 / tempos[i].bpm;
+    }
+    return t;
+}
+
+static void load_beat_patterns(FILE *f, const char *filename,
+                               uint32_t sample_rate) {
+    char line[128];
+    int lineno = 0;
+
+    meter_count = 1;
+    meters[0] = (MeterEvent){1, 4};
+    tempo_count = 0;
+    beat_offset_s = 0.0;
+
+    // Pass 1: offset, meter and tempo maps
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *tok = strtok(line, " \t\r\n");
+        if (!tok || tok[0] == '#') continue;
+
+        if (strcmp(tok, "offset") == 0) {
+            char *v = strtok(NULL, " \t\r\n");
+            if (!v) beat_error(filename, lineno, "offset needs ms");
+            beat_offset_s = atof(v) / 1000.0;
+
+        } else if (strcmp(tok, "meter") == 0 || strcmp(tok, "tempo") == 0) {
+            char *a = strtok(NULL, " \t\r\n");
+            char *b = strtok(NULL, " \t\r\n");
+            int bar = 1;
+            double beat = 1.0;
+            if (!a) beat_error(filename, lineno, "missing value");
+            if (b) {
+                if (parse_position(a, &bar, &beat) != 0)
+                    beat_error(filename, lineno, "bad position");
+                a = b;
+            }
+
+            if (tok[0] == 'm') {
+                int beats = atoi(a);
+                if (beat != 1.0 || beats < 1)
+                    beat_error(filename, lineno, "meter must start a bar");
+                if (bar <= meters[meter_count - 1].bar) {
+                    if (bar == meters[meter_count - 1].bar) {
+                        meters[meter_count - 1].beats = beats;
+                        continue;
+                    }
+                    beat_error(filename, lineno, "meter changes out of order");
+                }
+                if (meter_count >= MAX_MAP_EVENTS)
+                    beat_error(filename, lineno, "too many meter changes");
+                meters[meter_count++] = (MeterEvent){bar, beats};
+            } else {
+                double bpm = atof(a);
+                if (bpm <= 0.0)
+                    beat_error(filename, lineno, "bad tempo");
+                if (tempo_count >= MAX_MAP_EVENTS)
+                    beat_error(filename, lineno, "too many tempo changes");
+                tempos[tempo_count++] = (TempoEvent){bar, beat, 0.0, bpm, lineno};
             }
-            patterns[pattern_count++] = (Pattern){dur, p};
         }
     }
+
+    if (tempo_count == 0)
+        beat_file_error(filename, "no tempo given");
+
+    // Tempo positions to absolute beats now that the meter map is complete
+    for (int i = 0; i < tempo_count; ++i) {
+        if (!beat_in_bar(tempos[i].bar, tempos[i].bar_beat))
+            beat_error(filename, tempos[i].line, "beat past end of bar");
+        tempos[i].beat = position_to_beats(tempos[i].bar, tempos[i].bar_beat);
+        if (i > 0 && tempos[i].beat <= tempos[i - 1].beat)
+            beat_error(filename, tempos[i].line, "tempo changes out of order");
+    }
+    if (tempos[0].beat > 0.0)
+        beat_error(filename, tempos[0].line, "first tempo must be at 1:1");
+
+    // Pass 2: steps
+    rewind(f);
+    lineno = 0;
+    double prev_beats = -1.0, end_beats = -1.0;
+    int end_line = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *tok = strtok(line, " \t\r\n");
+        if (!tok || tok[0] == '#' || strcmp(tok, "offset") == 0 ||
+            strcmp(tok, "meter") == 0 || strcmp(tok, "tempo") == 0)
+            continue;
+
+        int bar;
+        double beat;
+        if (strcmp(tok, "end") == 0) {
+            char *pos = strtok(NULL, " \t\r\n");
+            if (!pos || parse_position(pos, &bar, &beat) != 0)
+                beat_error(filename, lineno, "bad end position");
+            if (!beat_in_bar(bar, beat))
+                beat_error(filename, lineno, "beat past end of bar");
+            end_line = lineno;
+            end_beats = position_to_beats(bar, beat);
+            continue;
+        }
+
+        if (parse_position(tok, &bar, &beat) != 0)
+            beat_error(filename, lineno, "bad position");
+        if (!beat_in_bar(bar, beat))
+            beat_error(filename, lineno, "beat past end of bar");
+        if (load_out->count >= MAX_PATTERNS) {
+            fprintf(stderr, "Too many patterns!\n");
+            break;
+        }
+
+        char *bits = strtok(NULL, " \t\r\n");
+        if (!bits) beat_error(filename, lineno, "missing pattern");
+
+        Pattern pat = {0};
+        pat.sfx = -1;
+        if (parse_levels(bits, &pat) != 0)
+            beat_error(filename, lineno, "bad pattern");
+        parse_step_options(&pat);
+
+        double beats = position_to_beats(bar, beat);
+        if (beats <= prev_beats)
+            beat_error(filename, lineno, "steps out of order");
+        prev_beats = beats;
+
+        pat.ideal_s = beats_to_seconds(beats);
+        pat.start_frame = (uint64_t)llround(pat.ideal_s * sample_rate);
+        add_pattern(&pat);
+    }
+
+    if (load_out->count == 0)
+        return;
+    if (end_beats < 0.0)
+        end_beats = prev_beats + 1.0;   // default: last step lasts a beat
+    if (end_beats <= prev_beats)
+        beat_error(filename, end_line, "end before last step");
+
+    // Each step ends where the next one starts
+    Pattern *steps = load_out->steps;
+    for (int i = 0; i < load_out->count; ++i) {
+        steps[i].end_frame = (i + 1 < load_out->count)
+            ? steps[i + 1].start_frame
+            : (uint64_t)llround(beats_to_seconds(end_beats) * sample_rate);
+        steps[i].duration_ms = (int)((steps[i].end_frame -
+                                      steps[i].start_frame) *
+                                     1000 / sample_rate);
+    }
+    load_out->end_ideal_s = beats_to_seconds(end_beats);
+}
+
+void load_patterns(const char *filename, uint32_t sample_rate) {
+    FILE *f = fopen(filename, "r");
+    if (!f) { perror("pattern open"); load_fail(); }
+    load_file = f;
+
+    load_out->count = 0;
+    load_out->uses_pwm = 0;
+
+    size_t len = strlen(filename);
+    if (len > 5 && strcmp(filename + len - 5, ".beat") == 0) {
+        load_beat_patterns(f, filename, sample_rate);
+    } else {
+        load_duration_patterns(f, sample_rate);
+    }
     fclose(f);
+    load_file = NULL;
+    loaded();
+}
+
+// --------------------------------------------------------------
+// LED cues embedded in the WAV: every "cue " point whose label (adtl
+// "labl", or "ltxt" text) is a pattern line such as "1010.1100 lin" is a
+// step starting at exactly that sample. An "ltxt" length ends the step
+// early; gaps between steps, and before the first one, are dark. Of
+// several cues on one sample the one with the highest id is used.
+// --------------------------------------------------------------
+typedef struct {
+    uint32_t id;
+    uint32_t frame;
+    uint32_t length;      // from ltxt, 0 = until the next cue
+    char label[128];
+} WavCue;
+
+static WavCue wav_cues[MAX_PATTERNS];
+
+// Label for one cue id. Walks the adtl sub-chunks in the mapping.
+static void cue_label(const WavData *wav, uint32_t id, WavCue *cue) {
+    const uint8_t *p = wav->adtl, *end = wav->adtl + wav->adtl_size;
+
+    while (p && p + sizeof(ChunkHeader) <= end) {
+        const ChunkHeader *ch = (const ChunkHeader *)p;
+        const uint8_t *body = p + sizeof(ChunkHeader);
+        uint32_t size = ch->chunk_size;
+        if (size > (size_t)(end - body))
+            size = end - body;
+
+        uint32_t cue_id;
+        if (size >= 4) {
+            memcpy(&cue_id, body, 4);
+            if (cue_id == id) {
+                const uint8_t *text = NULL;
+                size_t text_len = 0;
+
+                if (memcmp(ch->chunk_id, "labl", 4) == 0 ||
+                    memcmp(ch->chunk_id, "note", 4) == 0) {
+                    text = body + 4;
+                    text_len = size - 4;
+                } else if (memcmp(ch->chunk_id, "ltxt", 4) == 0 &&
+                           size >= sizeof(LtxtHeader)) {
+                    LtxtHeader lt;
+                    memcpy(&lt, body, sizeof(lt));
+                    cue->length = lt.sample_length;
+                    text = body + sizeof(LtxtHeader);
+                    text_len = size - sizeof(LtxtHeader);
+                }
+
+                // labl wins over ltxt text and notes
+                if (text && text_len &&
+                    (!cue->label[0] || memcmp(ch->chunk_id, "labl", 4) == 0)) {
+                    if (text_len >= sizeof(cue->label))
+                        text_len = sizeof(cue->label) - 1;
+                    memcpy(cue->label, text, text_len);
+                    cue->label[text_len] = '\0';
+                }
+            }
+        }
+        p = body + size + (size & 1);
+    }
+}
+
+// DAW marker names ("Verse 2") are not steps: only strict 8-digit
+// binary or @hex patterns are taken.
+static int is_pattern_token(const char *tok) {
+    if (tok[0] == '@')
+        return strlen(tok) == 17;
+
+    int digits = 0;
+    for (; *tok; ++tok) {
+        if (*tok == '0' || *tok == '1') digits++;
+        else if (*tok != '.') return 0;
+    }
+    return digits == 8;
+}
+
+static int cue_cmp(const void *a, const void *b) {
+    const WavCue *x = a, *y = b;
+    if (x->frame != y->frame)
+        return (x->frame > y->frame) - (x->frame < y->frame);
+    return (x->id > y->id) - (x->id < y->id);   // qsort is not stable
+}
+
+static void add_dark_step(uint64_t from, uint64_t to, uint32_t rate) {
+    Pattern pat = {0};
+    pat.sfx = -1;
+    pat.start_frame = from;
+    pat.end_frame = to;
+    pat.ideal_s = (double)from / rate;
+    pat.duration_ms = (int)((to - from) * 1000 / rate);
+    load_out->steps[load_out->count++] = pat;
+}
+
+int load_wav_cues(const WavData *wav) {
+    if (!wav->cue)
+        return 0;
+
+    uint32_t count;
+    memcpy(&count, wav->cue, 4);
+    if (count > (wav->cue_size - 4) / sizeof(CuePoint))
+        count = (wav->cue_size - 4) / sizeof(CuePoint);
+
+    int n = 0;
+    for (uint32_t i = 0; i < count && n < MAX_PATTERNS; ++i) {
+        CuePoint cp;
+        memcpy(&cp, wav->cue + 4 + i * sizeof(CuePoint), sizeof(cp));
+        if (cp.sample_offset >= wav->frames)
+            continue;
+
+        WavCue *c = &wav_cues[n];
+        memset(c, 0, sizeof(*c));
+        c->id = cp.id;
+        c->frame = cp.sample_offset;
+        cue_label(wav, cp.id, c);
+
+        char probe[sizeof(c->label)];
+        memcpy(probe, c->label, sizeof(probe));
+        char *tok = strtok(probe, " \t\r\n");
+        if (tok && is_pattern_token(tok))
+            n++;
+    }
+    if (n == 0)
+        return 0;
+
+    qsort(wav_cues, n, sizeof(WavCue), cue_cmp);
+
+    load_out->count = 0;
+    load_out->uses_pwm = 0;
+    uint64_t pos = 0;
+
+    for (int i = 0; i < n && load_out->count < MAX_PATTERNS - 1; ++i) {
+        WavCue *c = &wav_cues[i];
+        if (i + 1 < n && wav_cues[i + 1].frame == c->frame)
+            continue;    // two cues on one sample: the higher id wins
+
+        if (c->frame > pos)
+            add_dark_step(pos, c->frame, wav->sample_rate);
+
+        Pattern pat = {0};
+        pat.sfx = -1;
+        parse_levels(strtok(c->label, " \t\r\n"), &pat);
+        parse_step_options(&pat);
+
+        uint64_t next = (i + 1 < n) ? wav_cues[i + 1].frame : wav->frames;
+        uint64_t end = next;
+        if (c->length && c->frame + (uint64_t)c->length < next)
+            end = c->frame + c->length;
+
+        pat.start_frame = c->frame;
+        pat.end_frame = end;
+        pat.ideal_s = (double)c->frame / wav->sample_rate;
+        pat.duration_ms = (int)((end - c->frame) * 1000 / wav->sample_rate);
+        add_pattern(&pat);
+        pos = end;
+    }
+
+    // A region that ends before the track leaves the LEDs dark
+    if (pos < wav->frames && load_out->count < MAX_PATTERNS) {
+        add_dark_step(pos, wav->frames, wav->sample_rate);
+        pos = wav->frames;
+    }
+
+    load_out->end_ideal_s = (double)pos / wav->sample_rate;
+    loaded();
+    return load_out->count;
+}
+
+// --------------------------------------------------------------
+// Timing validator
+// --------------------------------------------------------------
+void report_pattern_timing(uint32_t sample_rate, size_t track_frames) {
+    double worst = 0.0;
+    int worst_idx = -1, short_steps = 0;
+
+    for (int i = 0; i < pattern_count; ++i) {
+        double actual = (double)patterns[i].start_frame / sample_rate;
+        double dev = fabs(actual - patterns[i].ideal_s);
+        if (dev > worst) {
+            worst = dev;
+            worst_idx = i;
+        }
+        if ((patterns[i].end_frame - patterns[i].start_frame) * 1000 <
+            70ull * sample_rate)
+            short_steps++;
+    }
+
+    double end_s = pattern_count ?
+        (double)patterns[pattern_count - 1].end_frame / sample_rate : 0.0;
+
+    printf("%d steps at %u Hz\n", pattern_count, sample_rate);
+    printf("Worst deviation from ideal grid: %.3f ms (%.1f samples)",
+           worst * 1000.0, worst * sample_rate);
+    if (worst_idx >= 0)
+        printf(" at step %d", worst_idx + 1);
+    printf("\n");
+    printf("End: ideal %.3f s, compiled %.3f s, drift %.3f ms\n",
+           pattern_end_ideal_s, end_s, (end_s - pattern_end_ideal_s) * 1000.0);
+    printf("Track: %.3f s, patterns end %+.3f s from track end\n",
+           (double)track_frames / sample_rate,
+           end_s - (double)track_frames / sample_rate);
+    if (short_steps)
+        printf("Warning: %d steps shorter than 70 ms\n", short_steps);
 }
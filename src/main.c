@@ -1,6 +1,12 @@
 ﻿#include "player.h"
 #include "gpio.h"
 #include "udp.h"
+#include "dmx.h"
+#include "mixer.h"
+#include "deadline.h"
+#include "status.h"
+#include "telemetry.h"
+#include "prep.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,20 +16,139 @@
 
 #define MAX_SONG_NAME 64
 
-
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options] [song]\n"
+            "  -d e131[@host]    stream LED frames as E1.31 (sACN)\n"
+            "  -d artnet[@host]  stream LED frames as Art-Net\n"
+            "  -u first[+count]  DMX universes (default 1+1)\n"
+            "  -c channel        DMX start channel of LED 0 (default 1)\n"
+            "  -s dir            sound effect directory (default " SFX_DIR ")\n"
+            "  -P thread=policy  overrun policy, thread led|audio,\n"
+            "                    policy catchup (default)|skip, led also compress,\n"
+            "                    audio also drop\n"
+            "  -F thread:at:ms   inject one stall of ms at 'at' ms (testing)\n"
+            "  -V                check pattern timing of the song, don't play\n"
+            "  -1                LEDs and audio on one event-loop RT thread\n"
+            "  -T file           append session telemetry (default " TEL_DEFAULT_FILE ")\n"
+            "  -L                also write the per-cycle audio CSV log\n"
+            "  -W                warm-start daemon, songs armed/started via UDP\n"
+            "  -B dir            prepare all songs of dir (e.g. " MUSIC_BASE_DIR "), don't play\n"
+            "  -j jobs           worker threads for -B (default: one per CPU)\n"
+            "Without a song name the interactive menu is shown.\n",
+            prog);
+}
 
 int main(int argc, char *argv[]) {
 
     openlog("sequencer", LOG_PID | LOG_CONS, LOG_USER);
 
+    int validate_only = 0, warm = 0, prep_jobs = 0;
+    DmxProtocol dmx_proto = DMX_NONE;
+    char *dmx_host = NULL;
+    int dmx_universe = 1, dmx_count = 1, dmx_channel = 1;
+    const char *sfx_dir = SFX_DIR;
+    const char *tel_file = TEL_DEFAULT_FILE;
+    const char *prep_dir = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:u:c:s:P:F:V1T:LWB:j:")) != -1) {
+        switch (opt) {
+        case 'd':
+            dmx_host = strchr(optarg, '@');
+            if (dmx_host) *dmx_host++ = '\0';
+            if (strcmp(optarg, "e131") == 0)
+                dmx_proto = DMX_E131;
+            else if (strcmp(optarg, "artnet") == 0)
+                dmx_proto = DMX_ARTNET;
+            else { usage(argv[0]); return 1; }
+            break;
+        case 'u':
+            if (sscanf(optarg, "%d+%d", &dmx_universe, &dmx_count) < 1) {
+                usage(argv[0]); return 1;
+            }
+            break;
+        case 'c':
+            dmx_channel = atoi(optarg);
+            break;
+        case 's':
+            sfx_dir = optarg;
+            break;
+        case 'P':
+            if (deadline_set_policy(optarg) != 0) {
+                usage(argv[0]); return 1;
+            }
+            break;
+        case 'V':
+            validate_only = 1;
+            break;
+        case '1':
+            player_set_single_thread(1);
+            break;
+        case 'T':
+            tel_file = optarg;
+            break;
+        case 'L':
+            player_set_csv_log(1);
+            break;
+        case 'W':
+            warm = 1;
+            break;
+        case 'B':
+            prep_dir = optarg;
+            break;
+        case 'j':
+            prep_jobs = atoi(optarg);
+            break;
+        case 'F':
+            if (deadline_set_fault(optarg) != 0) {
+                usage(argv[0]); return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (dmx_proto != DMX_NONE &&
+        dmx_open(dmx_proto, dmx_host, dmx_universe, dmx_count,
+                 dmx_channel) != 0)
+        return 1;
+
+    mixer_load_dir(sfx_dir);
+
+    if (validate_only) {
+        if (optind >= argc) { usage(argv[0]); return 1; }
+        validate_song(argv[optind]);
+        mixer_unload();
+        return 0;
+    }
+
+    if (prep_dir) {
+        int failed = prep_library(prep_dir, prep_jobs);
+        mixer_unload();
+        return failed != 0;
+    }
+
+    // Monitoring is optional, play on without it
+    if (status_open() != 0)
+        syslog(LOG_WARNING, "No shared status page for sequencer-top\n");
+    if (telemetry_open(tel_file) != 0)
+        syslog(LOG_WARNING, "Playing without telemetry\n");
+
     printf("Initializing GPIO...\n");
     gpio_init();
     gpio_set_outputs(led_lines, 8);
     gpio_all_off(led_lines, 8);
 
-    if (argc > 1) {
+    if (warm) {
+    // Daemon mode: a given song is armed right away
+        udp_warm_daemon(optind < argc ? argv[optind] : NULL);
+    }
+    else if (optind < argc) {
     // Parameter mode: just play the given song
-    	play_song(argv[1]);
+    	play_song(argv[optind]);
     }
     else {
     // No parameter -> full menu mode
@@ -85,6 +210,10 @@ int main(int argc, char *argv[]) {
     }
 
     gpio_cleanup();
+    dmx_close();
+    mixer_unload();
+    status_close();
+    telemetry_close();
     printf("GPIO cleaned up. Goodbye.\n");
 
     closelog();
@@ -0,0 +1,298 @@
+﻿#include "load.h"
+#include "mixer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <dirent.h>
+#include <setjmp.h>
+#include <syslog.h>
+#include <sys/mman.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+typedef struct {
+    char name[MIX_NAME_LEN];
+    WavData wav;
+    int usable;          // matches the current track format
+} EffectSample;
+
+enum { VOICE_IDLE = 0, VOICE_CLAIMED, VOICE_PLAYING };
+
+typedef struct {
+    int state;
+    int sample;
+    int16_t gain;
+    size_t pos;          // frames of the sample already mixed
+    size_t start;        // track frame to start at, 0 = next period
+} Voice;
+
+typedef struct {
+    size_t frame;
+    int sample;
+    int16_t gain;
+} SfxCue;
+
+static EffectSample samples[MIX_MAX_SAMPLES];
+static int sample_count = 0;
+static uint16_t track_channels = 0;
+
+static Voice voices[MIX_MAX_VOICES];
+static SfxCue cues[MIX_MAX_CUES];
+static int cue_count = 0, cue_next = 0;
+
+static int16_t mix_buf[MIX_MAX_PERIOD_FRAMES * MIX_MAX_CHANNELS]
+    __attribute__((aligned(16)));
+
+// Period last mixed. ALSA may reject it and get it again after the
+// underrun; mixing it twice would advance the voices twice.
+static size_t mixed_idx = SIZE_MAX, mixed_frames = 0;
+
+static unsigned long voices_dropped = 0, cues_skipped = 0;
+
+// --------------------------------------------------------------
+// Saturating mix kernels: dst = sat(dst + src * gain)
+// --------------------------------------------------------------
+static inline int16_t sat16(int32_t v) {
+    if (v > 32767)  return 32767;
+    if (v < -32768) return -32768;
+    return (int16_t)v;
+}
+
+#if !defined(__ARM_NEON) && defined(__ARM_FEATURE_SIMD32)
+// Inline asm rather than the ACLE intrinsic: older Raspbian GCCs lack it
+static inline uint32_t qadd16(uint32_t a, uint32_t b) {
+    uint32_t r;
+    __asm__ ("qadd16 %0, %1, %2" : "=r" (r) : "r" (a), "r" (b));
+    return r;
+}
+#endif
+
+static void mix_add_sat(int16_t *dst, const int16_t *src, size_t n,
+                        int16_t gain) {
+    size_t i = 0;
+
+#if defined(__ARM_NEON)
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t s = vqrdmulhq_n_s16(vld1q_s16(src + i), gain);
+        vst1q_s16(dst + i, vqaddq_s16(vld1q_s16(dst + i), s));
+    }
+#elif defined(__ARM_FEATURE_SIMD32)
+    // ARMv6 (Pi 1): no NEON, but QADD16 adds two halfwords per instruction
+    for (; i + 2 <= n; i += 2) {
+        uint32_t s = (uint16_t)((src[i] * gain) >> 15) |
+                     ((uint32_t)(uint16_t)((src[i + 1] * gain) >> 15) << 16);
+        uint32_t d;
+        memcpy(&d, dst + i, 4);
+        d = qadd16(d, s);
+        memcpy(dst + i, &d, 4);
+    }
+#elif defined(__SSE2__)
+    const __m128i g = _mm_set1_epi16(gain);
+    for (; i + 8 <= n; i += 8) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        s = _mm_slli_epi16(_mm_mulhi_epi16(s, g), 1);
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_adds_epi16(d, s));
+    }
+#endif
+
+    for (; i < n; ++i)
+        dst[i] = sat16(dst[i] + ((src[i] * gain) >> 15));
+}
+
+// --------------------------------------------------------------
+// Sample library
+// --------------------------------------------------------------
+int mixer_load_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        if (errno != ENOENT) perror("sfx opendir");
+        return -1;
+    }
+
+    // One bad file must not take the player down: skip it
+    jmp_buf trap;
+
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL && sample_count < MIX_MAX_SAMPLES) {
+        size_t len = strlen(e->d_name);
+        if (len < 5 || strcmp(e->d_name + len - 4, ".wav") != 0)
+            continue;
+        if (len - 4 >= MIX_NAME_LEN) {
+            fprintf(stderr, "sfx name too long, skipped: %s\n", e->d_name);
+            continue;
+        }
+
+        char path[256];
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+
+        EffectSample *s = &samples[sample_count];
+        memcpy(s->name, e->d_name, len - 4);
+        s->name[len - 4] = '\0';
+        if (setjmp(trap)) {
+            load_set_trap(NULL);
+            fprintf(stderr, "sfx skipped: %s\n", path);
+            continue;
+        }
+        load_set_trap(&trap);
+        s->wav = load_wav_mmap(path);
+        load_set_trap(NULL);
+        if (mlock(s->wav.mapping, s->wav.mapping_size) != 0)
+            perror("sfx mlock failed");
+        sample_count++;
+    }
+    closedir(d);
+
+    syslog(LOG_INFO, "Loaded %d sound effects from %s\n", sample_count, dir);
+    return sample_count;
+}
+
+void mixer_unload(void) {
+    for (int i = 0; i < sample_count; ++i)
+        free_wav_mmap(&samples[i].wav);
+    sample_count = 0;
+}
+
+int mixer_find(const char *name) {
+    for (int i = 0; i < sample_count; ++i)
+        if (strcmp(samples[i].name, name) == 0)
+            return i;
+    return -1;
+}
+
+void mixer_bind(uint32_t sample_rate, uint16_t channels) {
+    track_channels = channels;
+    for (int i = 0; i < sample_count; ++i) {
+        samples[i].usable = samples[i].wav.sample_rate == sample_rate &&
+                            samples[i].wav.channels == channels &&
+                            channels <= MIX_MAX_CHANNELS;
+        if (!samples[i].usable)
+            syslog(LOG_WARNING, "sfx '%s' format differs from track, "
+                   "disabled for this song\n", samples[i].name);
+    }
+
+    for (int v = 0; v < MIX_MAX_VOICES; ++v)
+        __atomic_store_n(&voices[v].state, VOICE_IDLE, __ATOMIC_RELEASE);
+    voices_dropped = cues_skipped = 0;
+    mixed_idx = SIZE_MAX;
+
+    // Pattern events become cues at their exact track frame
+    cue_count = cue_next = 0;
+    for (int i = 0; i < pattern_count && cue_count < MIX_MAX_CUES; ++i) {
+        if (patterns[i].sfx >= 0)
+            cues[cue_count++] = (SfxCue){
+                (size_t)patterns[i].start_frame,
+                patterns[i].sfx,
+                (int16_t)(SFX_GAIN_UNITY * patterns[i].sfx_gain / 100)
+            };
+    }
+}
+
+// --------------------------------------------------------------
+// Voices
+// --------------------------------------------------------------
+static int voice_start(int sample, int16_t gain, size_t start) {
+    for (int v = 0; v < MIX_MAX_VOICES; ++v) {
+        int idle = VOICE_IDLE;
+        if (__atomic_compare_exchange_n(&voices[v].state, &idle,
+                                        VOICE_CLAIMED, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            voices[v].sample = sample;
+            voices[v].gain = gain;
+            voices[v].pos = 0;
+            voices[v].start = start;
+            __atomic_store_n(&voices[v].state, VOICE_PLAYING,
+                             __ATOMIC_RELEASE);
+            return 0;
+        }
+    }
+    __atomic_add_fetch(&voices_dropped, 1, __ATOMIC_RELAXED);
+    return -1;
+}
+
+int mixer_trigger(int sample, int16_t gain_q15) {
+    if (sample < 0 || sample >= sample_count || !samples[sample].usable)
+        return -1;
+    return voice_start(sample, gain_q15, 0);
+}
+
+int mixer_needed(size_t frame_idx, size_t frames) {
+    if (frame_idx == mixed_idx && frames == mixed_frames)
+        return 1;
+    if (cue_next < cue_count && cues[cue_next].frame < frame_idx + frames)
+        return 1;
+    for (int v = 0; v < MIX_MAX_VOICES; ++v)
+        if (__atomic_load_n(&voices[v].state, __ATOMIC_ACQUIRE) ==
+            VOICE_PLAYING)
+            return 1;
+    return 0;
+}
+
+const int16_t *mixer_mix(const int16_t *track, size_t frame_idx,
+                         size_t frames) {
+    const size_t ch = track_channels;
+    if (frames > MIX_MAX_PERIOD_FRAMES || ch > MIX_MAX_CHANNELS)
+        return track;
+    if (frame_idx == mixed_idx && frames == mixed_frames)
+        return mix_buf;
+
+    while (cue_next < cue_count &&
+           cues[cue_next].frame < frame_idx + frames) {
+        const SfxCue *c = &cues[cue_next++];
+        // Jumped over by a skip: starting it now would be late, and
+        // every skipped cue would fire at once
+        if (c->frame < frame_idx) {
+            cues_skipped++;
+            continue;
+        }
+        if (samples[c->sample].usable)
+            voice_start(c->sample, c->gain, c->frame);
+    }
+
+    memcpy(mix_buf, track, frames * ch * sizeof(int16_t));
+
+    for (int v = 0; v < MIX_MAX_VOICES; ++v) {
+        Voice *vc = &voices[v];
+        if (__atomic_load_n(&vc->state, __ATOMIC_ACQUIRE) != VOICE_PLAYING)
+            continue;
+
+        size_t off = 0;
+        if (vc->start > frame_idx) {
+            off = vc->start - frame_idx;
+            if (off >= frames)
+                continue;
+        }
+
+        const WavData *w = &samples[vc->sample].wav;
+        size_t n = frames - off;
+        if (n > w->frames - vc->pos)
+            n = w->frames - vc->pos;
+
+        mix_add_sat(mix_buf + off * ch, w->pcm + vc->pos * ch, n * ch,
+                    vc->gain);
+        vc->pos += n;
+
+        if (vc->pos >= w->frames)
+            __atomic_store_n(&vc->state, VOICE_IDLE, __ATOMIC_RELEASE);
+    }
+
+    mixed_idx = frame_idx;
+    mixed_frames = frames;
+    return mix_buf;
+}
+
+void mixer_report(void) {
+    if (voices_dropped)
+        syslog(LOG_WARNING, "sfx: %lu triggers dropped, all %d voices busy\n",
+               voices_dropped, MIX_MAX_VOICES);
+    if (cues_skipped)
+        syslog(LOG_WARNING, "sfx: %lu cues skipped over after a stall\n",
+               cues_skipped);
+}
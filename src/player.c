@@ -1,8 +1,17 @@
-﻿#include "player.h"
+﻿#define _GNU_SOURCE   // RUSAGE_THREAD
+#include "player.h"
 #include "gpio.h"
 #include "setup_alsa.h"
 #include "load.h"
 #include "log.h"
+#include "pwm.h"
+#include "dmx.h"
+#include "mixer.h"
+#include "udp.h"
+#include "deadline.h"
+#include "evloop.h"
+#include "status.h"
+#include "telemetry.h"
 
 #include <pthread.h>
 #include <sched.h>
@@ -15,18 +24,26 @@
 
 #include <syslog.h>
 #include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #define AUDIO_PERIOD_FRAMES 441
 #define AUDIO_THREAD_PERIOD_MS 30
-#define LED_THREAD_PERIOD_MS 10
 #define MAX_RUNS 60000
 
 #define PREFILL_PERIODS      4
+#define AUDIO_RESYNC_FRAMES  (3 * AUDIO_PERIOD_FRAMES)   // debt that triggers a resync
 #define MIN_BUFFER_PERIODS   1
 #define MAX_BUFFER_PERIODS   5
 
-#define MUSIC_BASE_DIR "/home/pi/music/"
-
 // --------------------------------------------------------------
 // Globals for real-time statistics
 // --------------------------------------------------------------
@@ -34,10 +51,29 @@ static uint32_t gpio_shadow = 0;
 static long runtimes_us[MAX_RUNS];
 static long jitter_us[MAX_RUNS];
 static long wake_intervals_us[MAX_RUNS];
+static long mix_us[MAX_RUNS];
 static size_t runtime_index = 0;
 static int underrun_count = 0;
 
+static size_t led_wakes = 0;
+static long long led_jitter_sum_us = 0;
+static long led_jitter_max_us = 0;
+
+// CPU time and context switches of the RT threads, summed as they exit
+static struct rusage rt_usage;
+static pthread_mutex_t rt_usage_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int single_thread_mode = 0;
+static int csv_log = 0;
+
 static WavData wav;
+static struct timespec show_start;   // common time zero of both threads
+
+// Command arrival, and what it led to, for the start latency report
+static struct timespec trigger_time, first_sample_time, first_led_time;
+
+// Set to end the song early; the RT loops check it once per step/cycle
+static int show_stop = 0;
 
 // --------------------------------------------------------------
 // Utility functions
@@ -47,10 +83,71 @@ static long time_diff_us(struct timespec start, struct timespec end) {
            (end.tv_nsec - start.tv_nsec) / 1000L;
 }
 
+// 64-bit ns: a long only covers ~2 s on the Pi's 32-bit ABI
+static void timespec_add_ns(struct timespec *t, int64_t ns) {
+    t->tv_sec  += ns / 1000000000;
+    t->tv_nsec += ns % 1000000000;
+    if (t->tv_nsec >= 1000000000) {
+        t->tv_sec++;
+        t->tv_nsec -= 1000000000;
+    } else if (t->tv_nsec < 0) {
+        t->tv_sec--;
+        t->tv_nsec += 1000000000;
+    }
+}
+
+static int64_t timespec_diff_ns(struct timespec start, struct timespec end) {
+    return (int64_t)(end.tv_sec - start.tv_sec) * 1000000000 +
+           (end.tv_nsec - start.tv_nsec);
+}
+
+static void mark_first(struct timespec *t, struct timespec now) {
+    if (t->tv_sec == 0 && t->tv_nsec == 0)
+        *t = now;
+}
+
+// Thread usage when the current song started; zero for fresh threads
+static __thread struct rusage usage_base;
+
+static void mark_thread_usage(void) {
+    getrusage(RUSAGE_THREAD, &usage_base);
+}
+
+static void add_thread_usage(void) {
+    struct rusage ru;
+    if (getrusage(RUSAGE_THREAD, &ru) != 0)
+        return;
+
+    timersub(&ru.ru_utime, &usage_base.ru_utime, &ru.ru_utime);
+    timersub(&ru.ru_stime, &usage_base.ru_stime, &ru.ru_stime);
+    ru.ru_nvcsw  -= usage_base.ru_nvcsw;
+    ru.ru_nivcsw -= usage_base.ru_nivcsw;
+
+    pthread_mutex_lock(&rt_usage_lock);
+    timeradd(&rt_usage.ru_utime, &ru.ru_utime, &rt_usage.ru_utime);
+    timeradd(&rt_usage.ru_stime, &ru.ru_stime, &rt_usage.ru_stime);
+    rt_usage.ru_nvcsw  += ru.ru_nvcsw;
+    rt_usage.ru_nivcsw += ru.ru_nivcsw;
+    pthread_mutex_unlock(&rt_usage_lock);
+}
+
+void player_set_single_thread(int enable) {
+    single_thread_mode = enable;
+}
+
+void player_set_csv_log(int enable) {
+    csv_log = enable;
+}
+
 void reset_runtime_state(void) {
     runtime_index = 0;
     underrun_count = 0;
+    led_wakes = 0;
+    led_jitter_sum_us = 0;
+    led_jitter_max_us = 0;
+    memset(&rt_usage, 0, sizeof(rt_usage));
     gpio_shadow = 0;
+    deadline_reset();
     gpio_all_off(led_lines, 8);
 }
 
@@ -65,8 +162,23 @@ static void make_log_filename(char *dst, size_t len,
              tm.tm_hour, tm.tm_min, tm.tm_sec);
 }
 
+/*** Track period at fi, with any playing effects mixed over it ***/
+static const int16_t *period_source(size_t fi, long *mix_ns)
+{
+    const int16_t *src = &wav.pcm[fi * wav.channels];
+    if (!mixer_needed(fi, AUDIO_PERIOD_FRAMES))
+        return src;
+
+    struct timespec mix_start, mix_end;
+    clock_gettime(CLOCK_MONOTONIC, &mix_start);
+    src = mixer_mix(src, fi, AUDIO_PERIOD_FRAMES);
+    clock_gettime(CLOCK_MONOTONIC, &mix_end);
+    *mix_ns += timespec_diff_ns(mix_start, mix_end);
+    return src;
+}
+
 /*** Re-prefill after underrun ***/
-static void do_reprefill(size_t *frame_idx_ptr)
+static void do_reprefill(size_t *frame_idx_ptr, long *mix_ns)
 {
     size_t fi = *frame_idx_ptr;
 
@@ -76,7 +188,7 @@ static void do_reprefill(size_t *frame_idx_ptr)
 
         snd_pcm_sframes_t w =
             snd_pcm_writei(pcm,
-                           &wav.pcm[fi * wav.channels],
+                           period_source(fi, mix_ns),
                            AUDIO_PERIOD_FRAMES);
 
         if (w < 0) {
@@ -93,89 +205,212 @@ static void do_reprefill(size_t *frame_idx_ptr)
 
 
 // --------------------------------------------------------------
-// Audio thread
+// Status page (plain stores inside the seqlock, no syscalls)
 // --------------------------------------------------------------
-static void *audio_thread_fn(void *arg) {
-    size_t frame_idx = 0;
-    struct timespec next_time;
-    clock_gettime(CLOCK_MONOTONIC, &next_time);
-    struct timespec prev_wake_time = {0};
+static void publish_led(int index, long jitter, struct timespec now) {
+    StatusLed *s = &status->led;
+
+    status_write_begin(&s->seq);
+    s->pattern_index = index;
+    s->jitter_us = jitter;
+    s->late = led_deadline.count[DEADLINE_LATE];
+    s->missed = led_deadline.count[DEADLINE_MISSED];
+    s->update_ns = status_ns(now);
+    status_write_end(&s->seq);
+}
+
+static void publish_audio(size_t frame_idx, long delay, long jitter,
+                          struct timespec now) {
+    StatusAudio *s = &status->audio;
+
+    status_write_begin(&s->seq);
+    s->frame_pos = frame_idx;
+    s->alsa_delay = delay;
+    s->jitter_us = jitter;
+    s->underruns = underrun_count;
+    s->late = audio_deadline.count[DEADLINE_LATE];
+    s->missed = audio_deadline.count[DEADLINE_MISSED];
+    s->update_ns = status_ns(now);
+    status_write_end(&s->seq);
+}
+
+// --------------------------------------------------------------
+// Audio feeder
+// --------------------------------------------------------------
+typedef struct {
+    size_t frame_idx;
+    struct timespec prev_wake_time;
+    int resync_pending;
+    int replaying;
+    // When frame 0 would have been heard if playback never broke off;
+    // moved by underruns and skip/drop jumps (event-mode lateness)
+    struct timespec origin;
+} AudioState;
+
+// Anchor the audio clock to what ALSA is playing now
+static void audio_reanchor(AudioState *st) {
+    snd_pcm_sframes_t delay = 0;
+    if (snd_pcm_delay(pcm, &delay) < 0)
+        delay = 0;
+    clock_gettime(CLOCK_MONOTONIC, &st->origin);
+    timespec_add_ns(&st->origin, -((int64_t)st->frame_idx - delay) *
+                                 1000000000 / wav.sample_rate);
+}
+
+// One feeder cycle: overrun handling, then up to 3 periods into ALSA.
+// jitter is how late this cycle runs. Returns 0 at the end of the track.
+static int audio_cycle(AudioState *st, struct timespec start_time,
+                       long jitter) {
+    DeadlineMonitor *dm = &audio_deadline;
 
     const snd_pcm_sframes_t max_delay_frames =
         MAX_BUFFER_PERIODS * AUDIO_PERIOD_FRAMES;
 
-    while (frame_idx + AUDIO_PERIOD_FRAMES * 3 <= wav.frames &&
-           runtime_index < MAX_RUNS) {
+    if (st->frame_idx + AUDIO_PERIOD_FRAMES * 3 > wav.frames ||
+        runtime_index >= MAX_RUNS ||
+        __atomic_load_n(&show_stop, __ATOMIC_RELAXED))
+        return 0;
 
-        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_time, NULL);
+    struct timespec end_time;
 
-        struct timespec start_time, end_time;
-        clock_gettime(CLOCK_MONOTONIC, &start_time);
+    long wake_us = 0;
+    if (st->prev_wake_time.tv_sec != 0)
+        wake_us = time_diff_us(st->prev_wake_time, start_time);
+    st->prev_wake_time = start_time;
 
-        long wake_us = 0;
-        if (prev_wake_time.tv_sec != 0)
-            wake_us = time_diff_us(prev_wake_time, start_time);
-        prev_wake_time = start_time;
+    long total_runtime_us = 0;
+    long mix_ns = 0;
+    uint8_t tel_flags = 0;
 
-        long total_runtime_us = 0;
+    deadline_fault_point(dm, time_diff_us(show_start, start_time) / 1000);
 
-        snd_pcm_sframes_t delay_frames = 0;
-        if (snd_pcm_delay(pcm, &delay_frames) < 0)
-            delay_frames = 0;
+    if (jitter >= AUDIO_THREAD_PERIOD_MS * 1000L) {
+        // Catch-up replays the missed wakeups; count the stall once
+        if (!st->replaying) {
+            tel_flags |= TEL_F_MISSED;
+            deadline_stall(dm, jitter,
+                           jitter / (AUDIO_THREAD_PERIOD_MS * 1000L));
+        }
+        st->replaying = (dm->policy == OVERRUN_CATCHUP);
+        st->resync_pending = 1;
+    } else {
+        st->replaying = 0;
+        if (jitter > DEADLINE_LATE_US)
+            deadline_count(dm, DEADLINE_LATE, jitter);
+    }
 
-        for (int i = 0; i < 3; ++i) {
-            
-            if (delay_frames > max_delay_frames) {
-                break;
-            }
+    snd_pcm_sframes_t delay_frames = 0;
+    if (snd_pcm_delay(pcm, &delay_frames) < 0)
+        delay_frames = 0;
+
+    // Audible position vs. the show clock the LEDs run on
+    if (st->resync_pending) {
+        int64_t expected = timespec_diff_ns(show_start, start_time) *
+                           wav.sample_rate / 1000000000;
+        int64_t debt = expected - ((int64_t)st->frame_idx - delay_frames);
+
+        if (debt < AUDIO_RESYNC_FRAMES ||
+            dm->policy == OVERRUN_CATCHUP) {
+            st->resync_pending = 0;
+        } else if (dm->policy == OVERRUN_SKIP) {
+            st->frame_idx += debt - debt % AUDIO_PERIOD_FRAMES;
+            st->resync_pending = 0;
+            audio_reanchor(st);
+        } else {
+            // Drop: one period per cycle until caught up
+            st->frame_idx += AUDIO_PERIOD_FRAMES;
+            audio_reanchor(st);
+        }
+        if (st->frame_idx + AUDIO_PERIOD_FRAMES * 3 > wav.frames)
+            return 0;
+    }
 
-            struct timespec call_start, call_end;
-            clock_gettime(CLOCK_MONOTONIC, &call_start);
+    for (int i = 0; i < 3; ++i) {
+        
+        if (delay_frames > max_delay_frames) {
+            break;
+        }
 
-            snd_pcm_sframes_t written =
-                snd_pcm_writei(pcm, &wav.pcm[frame_idx * wav.channels],
-                               AUDIO_PERIOD_FRAMES);
-            if (written < 0) {
-                underrun_count++;
-                if (underrun_count <= 10 || underrun_count % 50 == 0)
-                    syslog(LOG_WARNING, "Underrun #%d: %s",
-                            underrun_count, snd_strerror(written));
-                snd_pcm_prepare(pcm);
+        struct timespec call_start, call_end;
+        clock_gettime(CLOCK_MONOTONIC, &call_start);
 
-                do_reprefill(&frame_idx);
+        snd_pcm_sframes_t written =
+            snd_pcm_writei(pcm, period_source(st->frame_idx, &mix_ns),
+                           AUDIO_PERIOD_FRAMES);
+        if (written < 0) {
+            underrun_count++;
+            tel_flags |= TEL_F_UNDERRUN;
+            deadline_count(dm, DEADLINE_XRUN, 0);
+            st->resync_pending = 1;
+            if (underrun_count <= 10 || underrun_count % 50 == 0)
+                syslog(LOG_WARNING, "Underrun #%d: %s",
+                        underrun_count, snd_strerror(written));
+            snd_pcm_prepare(pcm);
 
-                break;
-            }
+            do_reprefill(&st->frame_idx, &mix_ns);
+            // The silence shifted everything after it
+            audio_reanchor(st);
 
-            clock_gettime(CLOCK_MONOTONIC, &call_end);
-            total_runtime_us += time_diff_us(call_start, call_end);
-            frame_idx += AUDIO_PERIOD_FRAMES;
+            break;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &call_end);
+        mark_first(&first_sample_time, call_end);
+        total_runtime_us += time_diff_us(call_start, call_end);
+        st->frame_idx += AUDIO_PERIOD_FRAMES;
+
+        if (snd_pcm_delay(pcm, &delay_frames) < 0)
+            delay_frames = 0;
 
-            if (snd_pcm_delay(pcm, &delay_frames) < 0)
-                delay_frames = 0;
+    }
 
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    if (jitter > DEADLINE_LATE_US)
+        syslog(LOG_ERR, "Deadline miss at cycle %zu by %ld us\n",
+                runtime_index, jitter);
+
+    runtimes_us[runtime_index] = total_runtime_us;
+    wake_intervals_us[runtime_index] = wake_us;
+    jitter_us[runtime_index] = jitter;
+    mix_us[runtime_index] = mix_ns / 1000;
+    publish_audio(st->frame_idx, delay_frames, jitter, end_time);
+    tel_audio(time_diff_us(show_start, start_time), tel_flags, delay_frames,
+              jitter, total_runtime_us, mix_ns / 1000);
+
+    if (runtime_index % 100 == 0) {
+        snd_pcm_sframes_t delay;
+        if (snd_pcm_delay(pcm, &delay) == 0) {
+            syslog(LOG_INFO, "[Cycle %zu] ALSA delay: %ld frames (%.2f ms)\n",
+                    runtime_index, delay,
+                    (delay * 1000.0) / 44100.0);
         }
+    }
+
+    runtime_index++;
+    return 1;
+}
+
+static void *audio_thread_fn(void *arg) {
+    AudioState st = {0};
+    struct timespec next_time = show_start;
+
+    while (1) {
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_time, NULL);
+
+        struct timespec start_time;
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
 
-        clock_gettime(CLOCK_MONOTONIC, &end_time);
         long jitter = time_diff_us(next_time, start_time);
-        if (jitter < 0)
-            syslog(LOG_ERR, "Deadline miss at cycle %zu by %ld us\n",
-                    runtime_index, -jitter);
-
-        runtimes_us[runtime_index] = total_runtime_us;
-        wake_intervals_us[runtime_index] = wake_us;
-        jitter_us[runtime_index] = jitter;
-
-        if (runtime_index % 100 == 0) {
-            snd_pcm_sframes_t delay;
-            if (snd_pcm_delay(pcm, &delay) == 0) {
-                syslog(LOG_INFO, "[Cycle %zu] ALSA delay: %ld frames (%.2f ms)\n",
-                        runtime_index, delay,
-                        (delay * 1000.0) / 44100.0);
-            }
-        }
+        if (!audio_cycle(&st, start_time, jitter))
+            break;
 
-        runtime_index++;
+        // Only catch-up replays the wakeups lost in a stall
+        if (jitter >= AUDIO_THREAD_PERIOD_MS * 1000L &&
+            audio_deadline.policy != OVERRUN_CATCHUP) {
+            long missed = jitter / (AUDIO_THREAD_PERIOD_MS * 1000L);
+            timespec_add_ns(&next_time, (int64_t)missed *
+                            AUDIO_THREAD_PERIOD_MS * 1000000);
+        }
 
         // Advance next_time by one audio period
         next_time.tv_nsec += AUDIO_THREAD_PERIOD_MS * 1000000;
@@ -184,158 +419,940 @@ static void *audio_thread_fn(void *arg) {
             next_time.tv_nsec -= 1000000000;
         }
     }
+
+    add_thread_usage();
     return NULL;
 }
 
 // --------------------------------------------------------------
-// LED thread
+// LED timeline
 // --------------------------------------------------------------
-static void *led_thread_fn(void *arg) {  
 
-    int current_index = 0, tick_count = 0, ticks_for_current = 0;
-    struct timespec start, next_time;
-    clock_gettime(CLOCK_MONOTONIC, &start);
-    next_time = start;
+// Sample positions to ns from show start, each converted on its own
+static uint64_t frame_to_ns(uint64_t frame) {
+    return frame * 1000000000ull / wav.sample_rate;
+}
 
-    int tick = 0;
-    while (current_index < pattern_count) {
-        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_time, NULL);
+typedef struct {
+    int current_index;
+    struct timespec deadline;   // end of the pattern on show
+    long late_us;               // lateness of the last wakeup
+    uint8_t tel_flags;
+    int replaying;              // catch-up after a stall in progress
+
+    // Compress policy: patterns up to warp_last are squeezed so that the
+    // ideal span [warp_base, ideal end of warp_last] fits into
+    // [warp_origin, ideal end of warp_last].
+    int warp_last;
+    uint64_t warp_base, warp_origin, warp_src, warp_dst;
+} LedState;
+
+static void led_begin(LedState *st) {
+    memset(st, 0, sizeof(*st));
+    st->warp_last = -1;
+    st->warp_src = st->warp_dst = 1;
+}
 
-        struct timespec tick_start, write_start, write_end;
-        clock_gettime(CLOCK_MONOTONIC, &tick_start);
+// Show the current pattern and compute its absolute end.
+// Returns 0 once all patterns have been shown.
+static int led_show(LedState *st) {
+    const struct timespec start = show_start;
+    const int current_index = st->current_index;
 
-        if (tick_count == 0) {
-            int values[8];
-            for (int j = 0; j < 8; ++j)
-                values[j] = (patterns[current_index].pattern >> (7 - j)) & 1;
+    if (current_index >= pattern_count ||
+        __atomic_load_n(&show_stop, __ATOMIC_RELAXED))
+        return 0;
 
-            uint32_t set_mask = 0, clr_mask = 0;
-            for (int j = 0; j < 8; ++j) {
-                int pin = led_lines[j];
-                if (values[j]) set_mask |= (1u << pin);
-                else clr_mask |= (1u << pin);
-            }
+    struct timespec write_start, write_end;
 
-            clock_gettime(CLOCK_MONOTONIC, &write_start);
+    int values[8];
+    for (int j = 0; j < 8; ++j)
+        values[j] = (patterns[current_index].pattern >> (7 - j)) & 1;
 
-            uint32_t desired_state = gpio_shadow;
-            desired_state &= ~clr_mask;
-            desired_state |= set_mask;
+    uint32_t set_mask = 0, clr_mask = 0;
+    for (int j = 0; j < 8; ++j) {
+        int pin = led_lines[j];
+        if (values[j]) set_mask |= (1u << pin);
+        else clr_mask |= (1u << pin);
+    }
 
-            uint32_t led_mask = 0;
-            for (int j = 0; j < 8; ++j)
-                led_mask |= (1u << led_lines[j]);
+    clock_gettime(CLOCK_MONOTONIC, &write_start);
 
-            uint32_t bits_to_clear =
-                (gpio_shadow & ~desired_state) & led_mask;
-            uint32_t bits_to_set =
-                (~gpio_shadow & desired_state) & led_mask;
+    uint32_t desired_state = gpio_shadow;
+    desired_state &= ~clr_mask;
+    desired_state |= set_mask;
 
-            volatile uint32_t *GPSET0 = gpio + 0x1C / 4;
-            volatile uint32_t *GPCLR0 = gpio + 0x28 / 4;
+    uint32_t led_mask = 0;
+    for (int j = 0; j < 8; ++j)
+        led_mask |= (1u << led_lines[j]);
 
-            *GPSET0 = bits_to_set;
-            __sync_synchronize();
-            *GPCLR0 = bits_to_clear;
+    uint32_t bits_to_clear =
+        (gpio_shadow & ~desired_state) & led_mask;
+    uint32_t bits_to_set =
+        (~gpio_shadow & desired_state) & led_mask;
+
+    volatile uint32_t *GPSET0 = gpio + 0x1C / 4;
+    volatile uint32_t *GPCLR0 = gpio + 0x28 / 4;
+
+    *GPSET0 = bits_to_set;
+    __sync_synchronize();
+    *GPCLR0 = bits_to_clear;
 
-            gpio_shadow = desired_state;
+    gpio_shadow = desired_state;
+    dmx_publish(patterns[current_index].level);
 
-            clock_gettime(CLOCK_MONOTONIC, &write_end);
+    clock_gettime(CLOCK_MONOTONIC, &write_end);
+    mark_first(&first_led_time, write_end);
+    publish_led(current_index, st->late_us, write_end);
+    tel_led(time_diff_us(start, write_start), st->tel_flags, current_index,
+            st->late_us, time_diff_us(write_start, write_end));
 
-            int duration = patterns[current_index].duration_ms;
-            if (duration < 70) duration = 70;
-            duration = ((duration + 5) / 10) * 10;
-            ticks_for_current = duration / LED_THREAD_PERIOD_MS;
-            tick_count = ticks_for_current;
+    syslog(LOG_DEBUG, "%d,%ld,%ld\n",
+            current_index,
+            time_diff_us(start, write_start),
+            time_diff_us(write_start, write_end));
+
+    // Absolute end of this pattern, no per-step accumulation
+    uint64_t end_ns = frame_to_ns(patterns[current_index].end_frame);
+    uint64_t target_ns = end_ns;
+    if (current_index <= st->warp_last)
+        target_ns = st->warp_origin +
+                    (end_ns - st->warp_base) * st->warp_dst / st->warp_src;
+
+    st->deadline = start;
+    timespec_add_ns(&st->deadline, target_ns);
+
+    deadline_fault_point(&led_deadline, time_diff_us(start, write_end) / 1000);
+    return 1;
+}
+
+// Called once the current pattern's deadline has passed
+static void led_woke(LedState *st, struct timespec now) {
+    DeadlineMonitor *dm = &led_deadline;
+    const struct timespec start = show_start;
+
+    st->current_index++;
+
+    int64_t late_ns = timespec_diff_ns(st->deadline, now);
+    long late_us = (long)(late_ns / 1000);
+    st->late_us = late_us;
+    st->tel_flags = 0;
+    led_wakes++;
+    led_jitter_sum_us += late_us;
+    if (late_us > led_jitter_max_us)
+        led_jitter_max_us = late_us;
+
+    if (late_ns <= DEADLINE_LATE_US * 1000L) {
+        st->replaying = 0;
+        return;
+    }
+
+    // Which pattern should be showing now on the ideal timeline?
+    uint64_t pos_ns = timespec_diff_ns(start, now);
+    int cur = st->current_index;
+    while (cur < pattern_count &&
+           frame_to_ns(patterns[cur].end_frame) <= pos_ns)
+        cur++;
+
+    if (cur == st->current_index) {
+        // The last replayed step is late too; it is part of the stall
+        if (!st->replaying)
+            deadline_count(dm, DEADLINE_LATE, late_us);
+        st->replaying = 0;
+        return;
+    }
+
+    // Catch-up replays the steps of one stall; count the stall once,
+    // with the steps it put us behind. Reported after the song.
+    if (st->replaying)
+        return;
+    deadline_stall(dm, late_us, cur - st->current_index);
+    st->tel_flags = TEL_F_MISSED;
+    st->replaying = (dm->policy == OVERRUN_CATCHUP);
+    if (cur >= pattern_count)
+        return;
+
+    switch (dm->policy) {
+    case OVERRUN_CATCHUP:
+        // Absolute deadlines already in the past: missed patterns
+        // fire back to back until the schedule is reached again.
+        break;
+    case OVERRUN_SKIP:
+        st->current_index = cur;
+        break;
+    case OVERRUN_COMPRESS:
+        // Missed patterns plus the current one share the time left
+        // until the current one ends; in sync again after it.
+        st->warp_last   = cur;
+        st->warp_base   = frame_to_ns(patterns[st->current_index].start_frame);
+        st->warp_origin = pos_ns;
+        st->warp_src    = frame_to_ns(patterns[cur].end_frame) - st->warp_base;
+        st->warp_dst    = frame_to_ns(patterns[cur].end_frame) - pos_ns;
+        break;
+    case OVERRUN_DROP:
+        break;          // audio only
+    }
+}
+
+static void *led_thread_fn(void *arg) {  
+    LedState st;
+    led_begin(&st);
+
+    while (led_show(&st)) {
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &st.deadline, NULL);
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        led_woke(&st, now);
+    }
 
-            syslog(LOG_DEBUG, "%d,%ld,%ld\n",
-                    tick,
-                    time_diff_us(start, tick_start),
-                    time_diff_us(write_start, write_end));
+    add_thread_usage();
+    return NULL;
+}
+
+// --------------------------------------------------------------
+// LED PWM thread (songs with brightness levels or fades)
+// --------------------------------------------------------------
+
+// Sleep until PWM_SPIN_NS before the edge, then spin onto it. Slots shorter
+// than the spin window never enter the kernel.
+static void pwm_wait_until(const struct timespec *edge) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (timespec_diff_ns(now, *edge) > PWM_SPIN_NS) {
+        struct timespec wake = *edge;
+        wake.tv_nsec -= PWM_SPIN_NS;
+        while (wake.tv_nsec < 0) {
+            wake.tv_sec--;
+            wake.tv_nsec += 1000000000;
         }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+    }
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while (timespec_diff_ns(now, *edge) > 0);
+}
 
-        tick_count--;
-        if (tick_count == 0) current_index++;
-        tick++;
+// Levels for the frame shown at song position pos_ns. Advances *idx and
+// *from past finished steps; returns 0 once the song ends.
+static int pwm_levels_at(uint64_t pos_ns, int *idx,
+                         uint8_t from[8], uint8_t out[8]) {
+    while (*idx < pattern_count) {
+        uint64_t start = frame_to_ns(patterns[*idx].start_frame);
+        uint64_t end   = frame_to_ns(patterns[*idx].end_frame);
+        if (pos_ns < end) {
+            pwm_fade_levels(out, from, patterns[*idx].level,
+                            patterns[*idx].fade,
+                            pos_ns > start ? pos_ns - start : 0, end - start);
+            return 1;
+        }
+        memcpy(from, patterns[*idx].level, 8);
+        (*idx)++;
+    }
+    return 0;
+}
 
-        next_time.tv_nsec += LED_THREAD_PERIOD_MS * 1000000;
-        while (next_time.tv_nsec >= 1000000000) {
-            next_time.tv_sec++;
-            next_time.tv_nsec -= 1000000000;
+static void *led_pwm_thread_fn(void *arg) {
+    DeadlineMonitor *dm = &led_deadline;
+    static PwmFrame frames[2];
+    const uint32_t frame_ns = pwm_frame_ns();
+
+    volatile uint32_t *GPSET0 = gpio + 0x1C / 4;
+    volatile uint32_t *GPCLR0 = gpio + 0x28 / 4;
+
+    int idx = 0, cur = 0, running = 1, tel_idx = -1, replaying = 0;
+    uint8_t from[8] = {0}, levels[8], published[8];
+    size_t cycles = 0, late_slots = 0;
+
+    running = pwm_levels_at(0, &idx, from, levels);
+    pwm_build_frame(&frames[cur], levels, led_lines);
+    memcpy(published, levels, 8);
+    dmx_publish(levels);
+
+    struct timespec start, edge, now, cpu_start, cpu_end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+    start = show_start;
+    edge = start;
+
+    while (running && !__atomic_load_n(&show_stop, __ATOMIC_RELAXED)) {
+        deadline_fault_point(dm, (long)((uint64_t)cycles * frame_ns / 1000000));
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t late_ns = timespec_diff_ns(edge, now);
+        long late_us = late_ns > 0 ? (long)(late_ns / 1000) : 0;
+        if (late_ns <= DEADLINE_LATE_US * 1000L) {
+            replaying = 0;
+        } else {
+            uint64_t missed = late_ns / frame_ns;
+            // Catch-up runs the missed frames back to back: one stall
+            if (!replaying) {
+                if (missed)
+                    deadline_stall(dm, late_us, missed);
+                else
+                    deadline_count(dm, DEADLINE_LATE, late_us);
+            }
+            replaying = missed && dm->policy == OVERRUN_CATCHUP;
+
+            // Levels are a function of the position, there is nothing to
+            // replay: skip and compress both jump to the current frame.
+            if (missed && dm->policy != OVERRUN_CATCHUP) {
+                cycles += missed;
+                timespec_add_ns(&edge, (int64_t)(missed * frame_ns));
+                running = pwm_levels_at((uint64_t)cycles * frame_ns, &idx,
+                                        from, levels);
+                if (!running)
+                    break;
+                pwm_build_frame(&frames[cur], levels, led_lines);
+            }
         }
+
+        const PwmFrame *f = &frames[cur];
+
+        for (int s = 0; s < f->count; ++s) {
+            *GPSET0 = f->slot[s].set_mask;
+            __sync_synchronize();
+            *GPCLR0 = f->slot[s].clr_mask;
+
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            mark_first(&first_led_time, now);
+            if (timespec_diff_ns(edge, now) > f->slot[s].duration_ns)
+                late_slots++;
+
+            timespec_add_ns(&edge, f->slot[s].duration_ns);
+
+            if (s == 0) {
+                // Build the next frame inside the longest slot
+                uint64_t next_pos = (uint64_t)(cycles + 1) * frame_ns;
+                running = pwm_levels_at(next_pos, &idx, from, levels);
+                pwm_build_frame(&frames[cur ^ 1], levels, led_lines);
+                if (memcmp(levels, published, 8) != 0) {
+                    memcpy(published, levels, 8);
+                    dmx_publish(levels);
+                }
+                publish_led(idx, late_us, now);
+                // One record per step as in the other modes, not per frame
+                if (idx != tel_idx && idx < pattern_count) {
+                    tel_idx = idx;
+                    tel_led(time_diff_us(start, now),
+                            late_ns >= (int64_t)frame_ns ? TEL_F_MISSED : 0,
+                            idx, late_us, 0);
+                }
+            }
+
+            pwm_wait_until(&edge);
+        }
+
+        cur ^= 1;
+        cycles++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    add_thread_usage();
+    gpio_shadow = 0;
+    for (int s = 0; s < frames[cur].count; ++s)
+        gpio_shadow |= frames[cur].slot[s].set_mask;
+
+    double wall_s = timespec_diff_ns(start, now) / 1e9;
+    double cpu_s  = timespec_diff_ns(cpu_start, cpu_end) / 1e9;
+    syslog(LOG_INFO, "PWM: %zu cycles, %.1f Hz refresh, CPU %.1f%%, "
+           "%zu late slots\n",
+           cycles, wall_s > 0 ? cycles / wall_s : 0.0,
+           wall_s > 0 ? 100.0 * cpu_s / wall_s : 0.0, late_slots);
+    printf("PWM refresh %.1f Hz (target %d), LED thread CPU %.1f%%, "
+           "%zu late slots\n",
+           wall_s > 0 ? cycles / wall_s : 0.0, PWM_REFRESH_HZ,
+           wall_s > 0 ? 100.0 * cpu_s / wall_s : 0.0, late_slots);
+
+    return NULL;
+}
+
+// --------------------------------------------------------------
+// Single-thread event loop (LED timeline + audio feeder as tasks)
+// --------------------------------------------------------------
+
+// The feeder is woken by ALSA once this little is left queued; it then
+// tops the buffer up like one 30 ms cycle of the audio thread does.
+#define EVENT_AUDIO_LOW_FRAMES (3 * AUDIO_PERIOD_FRAMES)
+
+typedef struct {
+    AudioState st;
+    struct pollfd pfd[EVLOOP_MAX_FDS];
+    int npfd;
+} AudioTask;
+
+typedef struct {
+    LedState st;
+    int tfd;
+} LedTask;
+
+static void arm_led_timer(LedTask *lt) {
+    struct itimerspec its = { .it_value = lt->st.deadline };
+    if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+        its.it_value.tv_nsec = 1;   // zero would disarm the timer
+    timerfd_settime(lt->tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static int led_task_ready(EvTask *t) {
+    LedTask *lt = t->ctx;
+    uint64_t expirations;
+    return read(lt->tfd, &expirations, sizeof(expirations)) > 0;
+}
+
+static int led_task_run(EvTask *t) {
+    LedTask *lt = t->ctx;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    led_woke(&lt->st, now);
+    if (!led_show(&lt->st))
+        return 0;
+
+    arm_led_timer(lt);
+    t->deadline = lt->st.deadline;
+    return 1;
+}
+
+static int audio_task_ready(EvTask *t) {
+    AudioTask *at = t->ctx;
+    unsigned short revents = 0;
+
+    for (int f = 0; f < at->npfd; ++f)
+        at->pfd[f].revents = t->revents[f];
+    snd_pcm_poll_descriptors_revents(pcm, at->pfd, at->npfd, &revents);
+    // POLLERR is an xrun; writei reports it and the cycle recovers
+    return (revents & (POLLOUT | POLLERR)) != 0;
+}
+
+static int audio_task_run(EvTask *t) {
+    AudioTask *at = t->ctx;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // Lateness against an absolute deadline, as the audio thread
+    // measures it: the moment what was written so far drained to the
+    // wakeup level, on the audio clock re-anchored after each break
+    long jitter = 0;
+    if (at->st.frame_idx > EVENT_AUDIO_LOW_FRAMES) {
+        struct timespec due = at->st.origin;
+        timespec_add_ns(&due, (int64_t)(at->st.frame_idx -
+                                        EVENT_AUDIO_LOW_FRAMES) *
+                              1000000000 / wav.sample_rate);
+        jitter = time_diff_us(due, now);
+        if (jitter < 0)
+            jitter = 0;     // ALSA woke us a little early
+    }
+
+    if (!audio_cycle(&at->st, now, jitter))
+        return 0;
+
+    // Due when the queue would run dry
+    snd_pcm_sframes_t delay = 0;
+    if (snd_pcm_delay(pcm, &delay) < 0)
+        delay = 0;
+    t->deadline = now;
+    timespec_add_ns(&t->deadline, (int64_t)delay * 1000000000 /
+                                  wav.sample_rate);
+    return 1;
+}
+
+static void *event_thread_fn(void *arg) {
+    LedTask lt;
+    AudioTask at = {0};
+    EvTask led_task = { .name = "led", .ready = led_task_ready,
+                        .run = led_task_run, .ctx = &lt };
+    EvTask audio_task = { .name = "audio", .ready = audio_task_ready,
+                          .run = audio_task_run, .ctx = &at };
+
+    lt.tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (lt.tfd < 0) {
+        perror("timerfd_create");
+        return NULL;
+    }
+    led_task.fds[0] = lt.tfd;
+    led_task.events[0] = EPOLLIN;
+    led_task.nfds = 1;
+
+    if (alsa_wake_at_delay(EVENT_AUDIO_LOW_FRAMES) < 0)
+        syslog(LOG_WARNING, "Could not set ALSA wakeup level\n");
+
+    at.npfd = snd_pcm_poll_descriptors_count(pcm);
+    if (at.npfd <= 0 || at.npfd > EVLOOP_MAX_FDS) {
+        fprintf(stderr, "Unusable ALSA poll descriptor count %d\n", at.npfd);
+        close(lt.tfd);
+        alsa_wake_restore();
+        return NULL;
+    }
+    snd_pcm_poll_descriptors(pcm, at.pfd, at.npfd);
+    for (int f = 0; f < at.npfd; ++f) {
+        audio_task.fds[f] = at.pfd[f].fd;
+        audio_task.events[f] = at.pfd[f].events;
     }
+    audio_task.nfds = at.npfd;
+    audio_task.deadline = show_start;
+    at.st.origin = show_start;
+
+    led_begin(&lt.st);
+    EvTask *tasks[] = { &led_task, &audio_task };
+    int count = 2;
+    if (led_show(&lt.st)) {
+        arm_led_timer(&lt);
+        led_task.deadline = lt.st.deadline;
+    } else {
+        tasks[0] = &audio_task;
+        count = 1;
+    }
+
+    evloop_run(tasks, count);
 
+    close(lt.tfd);
+    alsa_wake_restore();
+    add_thread_usage();
+    syslog(LOG_INFO, "Event loop: %lu LED runs, %lu audio runs\n",
+           led_task.runs, audio_task.runs);
     return NULL;
 }
 
+// Cost of the RT side of one song, comparable between both modes
+static void report_rt_usage(const char *mode, struct timespec end) {
+    double wall_s = timespec_diff_ns(show_start, end) / 1e9;
+    double cpu_s = rt_usage.ru_utime.tv_sec + rt_usage.ru_stime.tv_sec +
+                   (rt_usage.ru_utime.tv_usec + rt_usage.ru_stime.tv_usec) / 1e6;
+
+    long audio_max = 0;
+    long long audio_sum = 0;
+    for (size_t i = 0; i < runtime_index; ++i) {
+        audio_sum += jitter_us[i];
+        if (jitter_us[i] > audio_max)
+            audio_max = jitter_us[i];
+    }
+
+    printf("RT [%s]: %.1f s, CPU %.2f%%, ctx switches %ld voluntary / %ld involuntary (%.1f/s)\n",
+           mode, wall_s, wall_s > 0 ? 100.0 * cpu_s / wall_s : 0.0,
+           rt_usage.ru_nvcsw, rt_usage.ru_nivcsw,
+           wall_s > 0 ? (rt_usage.ru_nvcsw + rt_usage.ru_nivcsw) / wall_s : 0.0);
+    printf("RT [%s]: LED jitter avg %lld us max %ld us, audio jitter avg %lld us max %ld us\n",
+           mode,
+           led_wakes ? led_jitter_sum_us / (long long)led_wakes : 0,
+           led_jitter_max_us,
+           runtime_index ? audio_sum / (long long)runtime_index : 0,
+           audio_max);
+}
+
 // --------------------------------------------------------------
 // Playback
 // --------------------------------------------------------------
-void play_song(const char *base_name) {
+// A beat-grid .beat file wins over the .txt duration list
+static void song_paths(const char *base_name, char *wav_file,
+                       char *pattern_file, size_t len) {
+    snprintf(wav_file, len, "%s%s.wav", MUSIC_BASE_DIR, base_name);
+    snprintf(pattern_file, len, "%s%s.beat", MUSIC_BASE_DIR, base_name);
+    if (access(pattern_file, R_OK) != 0)
+        snprintf(pattern_file, len, "%s%s.txt", MUSIC_BASE_DIR, base_name);
+}
+
+// LED cues embedded in the WAV take precedence over a pattern file.
+// Returns the file the steps came from.
+static const char *load_song_patterns(const WavData *w, const char *wav_file,
+                                      const char *pattern_file) {
+    if (load_wav_cues(w) > 0)
+        return wav_file;
+
+    load_patterns(pattern_file, w->sample_rate);
+    return pattern_file;
+}
+
+void validate_song(const char *base_name) {
     char wav_file[128], pattern_file[128];
-    snprintf(wav_file, sizeof(wav_file), "%s%s.wav", MUSIC_BASE_DIR, base_name);
-    snprintf(pattern_file, sizeof(pattern_file), "%s%s.txt", MUSIC_BASE_DIR, base_name);
+    song_paths(base_name, wav_file, pattern_file, sizeof(wav_file));
 
-    char led_log[128], audio_log[128];
-    make_log_filename(led_log, sizeof(led_log), "led_log", base_name);
-    make_log_filename(audio_log, sizeof(audio_log), "audio_log", base_name);
+    WavData w = load_wav_mmap(wav_file);
+    printf("%s:\n", load_song_patterns(&w, wav_file, pattern_file));
+    report_pattern_timing(w.sample_rate, w.frames);
+    free_wav_mmap(&w);
+}
 
-    printf("\n=== Starting playback of '%s' ===\n", base_name);
+// --------------------------------------------------------------
+// Song lifecycle: stage (load), ready (bind, open), launch, finish
+// --------------------------------------------------------------
+static struct {
+    char name[64];
+    char audio_log[128];
+    int event_mode;
+    void *(*led_fn)(void *);
+    void *(*audio_fn)(void *);   // NULL: the LED side runs both
+    int armed;
+} song;
+
+// A song loaded ahead: WAV mapped and locked, steps parsed into a set of
+// their own. Nothing the playing song uses is touched, so the next song
+// can be staged while the current one plays.
+typedef struct {
+    char name[64];
+    WavData wav;
+    PatternSet *steps;
+    int staged;
+} StagedSong;
+
+static PatternSet step_banks[2];
+static StagedSong next_song;
+
+// The bank the RT threads are not reading from
+static PatternSet *free_bank(void) {
+    return patterns == step_banks[0].steps ? &step_banks[1] : &step_banks[0];
+}
 
-    reset_runtime_state();
+static void song_stage(const char *base_name, StagedSong *st) {
+    char wav_file[128], pattern_file[128];
+    song_paths(base_name, wav_file, pattern_file, sizeof(wav_file));
 
-    wav = load_wav_mmap(wav_file);
-    if (mlock(wav.mapping, wav.mapping_size) != 0) {
+    snprintf(st->name, sizeof(st->name), "%s", base_name);
+    st->wav = load_wav_mmap(wav_file);
+    if (mlock(st->wav.mapping, st->wav.mapping_size) != 0) {
         perror("mlock failed");
 	// avoids Linux demand paging (a.k.a. lazy loading), 4 kB/s disk -> RAM.
 	// locks all the song into RAM, negating the effects of flash page faults
 	// in case of error program may continue, but audio is now soft-RT instead of hard-RT
     }
 
+    st->steps = free_bank();
+    load_set_target(st->steps);
+    const char *steps_from = load_song_patterns(&st->wav, wav_file,
+                                                pattern_file);
+    load_set_target(NULL);
+    syslog(LOG_INFO, "%d steps from %s\n", st->steps->count, steps_from);
+    st->staged = 1;
+}
+
+// Drop a staged song, or what a failed staging left mapped
+static void song_unstage(StagedSong *st) {
+    free_wav_mmap(&st->wav);
+    st->staged = 0;
+}
+
+// Make the staged song the one to play. Only while no song plays.
+static void song_ready(StagedSong *st) {
+    snprintf(song.name, sizeof(song.name), "%s", st->name);
+    make_log_filename(song.audio_log, sizeof(song.audio_log),
+                      "audio_log", st->name);
+
+    reset_runtime_state();
+    memset(&first_sample_time, 0, sizeof(first_sample_time));
+    memset(&first_led_time, 0, sizeof(first_led_time));
+
+    wav = st->wav;
+    memset(&st->wav, 0, sizeof(st->wav));
+    pattern_set_install(st->steps);
+    st->staged = 0;
 
     uint32_t sample_rate = wav.sample_rate;
     uint16_t channels    = wav.channels;
-    load_patterns(pattern_file);
-    setup_alsa(sample_rate, channels);
+    mixer_bind(sample_rate, channels);
+    alsa_ensure(sample_rate, channels);
 
 // Hard lock. Uncomment only for full lock for 'harder' RT behaviour.
 //    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
 //        perror("mlockall failed");
 //	// locks everything into RAM (including code, data, libraries, stacks of RT threads)
 //	// may continue, but becomes soft-rt
-    
+
 //    }
 
-    pthread_t audio_thread, led_thread;
+    // The PWM engine needs a thread of its own for its sub-ms slots
+    song.event_mode = single_thread_mode && !pattern_uses_pwm;
+    if (single_thread_mode && pattern_uses_pwm)
+        printf("Brightness levels in use, playing with two RT threads\n");
+
+    if (song.event_mode) {
+        // One RT thread at the LED priority runs both tasks
+        song.led_fn = event_thread_fn;
+        song.audio_fn = NULL;
+    } else {
+        song.led_fn = pattern_uses_pwm ? led_pwm_thread_fn : led_thread_fn;
+        song.audio_fn = audio_thread_fn;
+    }
 
-    struct sched_param audio_param = {.sched_priority = 75};
-    struct sched_param led_param   = {.sched_priority = 80};
+    telemetry_begin(song.name, sample_rate,
+                    song.event_mode ? TEL_MODE_EVENT :
+                    pattern_uses_pwm ? TEL_MODE_PWM : TEL_MODE_THREADS);
+    song.armed = 1;
+}
 
-    pthread_attr_t audio_attr, led_attr;
-    pthread_attr_init(&audio_attr);
-    pthread_attr_setinheritsched(&audio_attr, PTHREAD_EXPLICIT_SCHED);
-    pthread_attr_setschedpolicy(&audio_attr, SCHED_FIFO);
-    pthread_attr_setschedparam(&audio_attr, &audio_param);
+// Undo song_ready() for a song that was never started
+static void song_disarm(void) {
+    telemetry_cancel();
+    free_wav_mmap(&wav);
+    song.armed = 0;
+}
 
-    pthread_attr_init(&led_attr);
-    pthread_attr_setinheritsched(&led_attr, PTHREAD_EXPLICIT_SCHED);
-    pthread_attr_setschedpolicy(&led_attr, SCHED_FIFO);
-    pthread_attr_setschedparam(&led_attr, &led_param);
+// Both threads schedule against the same time zero
+static void song_launch(void) {
+    __atomic_store_n(&show_stop, 0, __ATOMIC_RELAXED);
+    clock_gettime(CLOCK_MONOTONIC, &show_start);
+    status_song_begin(song.name, wav.sample_rate, wav.frames, pattern_count,
+                      show_start);
+}
 
-    pthread_create(&led_thread, &led_attr, led_thread_fn, led_log);
-    pthread_create(&audio_thread, &audio_attr, audio_thread_fn, NULL);
+static void report_start_latency(void) {
+    double sample_ms = first_sample_time.tv_sec ?
+        timespec_diff_ns(trigger_time, first_sample_time) / 1e6 : -1.0;
+    double led_ms = first_led_time.tv_sec ?
+        timespec_diff_ns(trigger_time, first_led_time) / 1e6 : -1.0;
 
-    pthread_join(audio_thread, NULL);
-    pthread_join(led_thread, NULL);
+    printf("Trigger to first sample %.2f ms, to first LED %.2f ms\n",
+           sample_ms, led_ms);
+    syslog(LOG_INFO, "Start latency: sample %.2f ms, LED %.2f ms\n",
+           sample_ms, led_ms);
+}
 
+static void song_finish(int keep_alsa) {
+    struct timespec show_end;
+    clock_gettime(CLOCK_MONOTONIC, &show_end);
+    status_song_end();
+    telemetry_end(time_diff_us(show_start, show_end), underrun_count);
+
+    udp_control_stop();
+    dmx_stop();
+    mixer_report();
+    deadline_report();
+    report_rt_usage(song.event_mode ? "event loop" : "two threads", show_end);
+    report_start_latency();
     gpio_all_off(led_lines, 8);
-    alsa_close();
+    if (keep_alsa)
+        alsa_rearm();
+    else
+        alsa_close();
 
-    save_runtime_log(audio_log,
-                     runtimes_us, wake_intervals_us,
-                     jitter_us, runtime_index, underrun_count);
+    // Telemetry is already on disk; the per-cycle CSV is opt-in (-L)
+    if (csv_log)
+        save_runtime_log(song.audio_log,
+                         runtimes_us, wake_intervals_us,
+                         jitter_us, mix_us, runtime_index, underrun_count);
 
     free_wav_mmap(&wav);
+    song.armed = 0;
+
+    printf("Playback finished for '%s'. Logs saved.\n", song.name);
+}
+
+static void rt_attr(pthread_attr_t *attr, int priority) {
+    struct sched_param param = {.sched_priority = priority};
+
+    pthread_attr_init(attr);
+    pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+    pthread_attr_setschedparam(attr, &param);
+}
+
+void play_song(const char *base_name) {
+    printf("\n=== Starting playback of '%s' ===\n", base_name);
+    clock_gettime(CLOCK_MONOTONIC, &trigger_time);
+
+    song_stage(base_name, &next_song);
+    song_ready(&next_song);
+
+    pthread_t audio_thread, led_thread;
+    pthread_attr_t audio_attr, led_attr;
+    rt_attr(&audio_attr, 75);
+    rt_attr(&led_attr, 80);
+
+    dmx_start();
+    udp_control_start();
+    telemetry_start();
+
+    song_launch();
+    pthread_create(&led_thread, &led_attr, song.led_fn, NULL);
+    if (song.audio_fn) {
+        pthread_create(&audio_thread, &audio_attr, song.audio_fn, NULL);
+        pthread_join(audio_thread, NULL);
+    }
+    pthread_join(led_thread, NULL);
+
+    song_finish(0);
+}
+
+// --------------------------------------------------------------
+// Warm start: RT threads parked on a futex, device kept open and
+// the song armed ahead, so a start only publishes the time zero.
+// The caller polls player_done_fd() and calls player_finish().
+// --------------------------------------------------------------
+static pthread_t warm_led_thread, warm_audio_thread;
+static uint32_t warm_gen;       // bumped per start; futex word
+static uint32_t warm_done;      // workers finished with this song
+static int warm_done_fd = -1;   // eventfd, written by the last worker
+static int warm_quit;
+static int warm_running = 0;
+static int warm_playing = 0;
+
+static void futex_wait(uint32_t *addr, uint32_t val) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(uint32_t *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static void *warm_worker_fn(void *arg) {
+    const int is_led = arg != NULL;
+    uint32_t seen = 0;
+
+    while (1) {
+        uint32_t gen;
+        while ((gen = __atomic_load_n(&warm_gen, __ATOMIC_ACQUIRE)) == seen)
+            futex_wait(&warm_gen, seen);
+        seen = gen;
+        if (__atomic_load_n(&warm_quit, __ATOMIC_ACQUIRE))
+            break;
+
+        void *(*fn)(void *) = is_led ? song.led_fn : song.audio_fn;
+        if (fn) {
+            mark_thread_usage();
+            fn(NULL);
+        }
+
+        if (__atomic_add_fetch(&warm_done, 1, __ATOMIC_ACQ_REL) == 2)
+            eventfd_write(warm_done_fd, 1);
+    }
+    return NULL;
+}
+
+int player_warm_init(void) {
+    pthread_attr_t audio_attr, led_attr;
+    rt_attr(&audio_attr, 75);
+    rt_attr(&led_attr, 80);
+
+    warm_done_fd = eventfd(0, EFD_CLOEXEC);
+    if (warm_done_fd < 0) {
+        perror("eventfd");
+        return -1;
+    }
+
+    if (pthread_create(&warm_led_thread, &led_attr, warm_worker_fn,
+                       (void *)1) != 0 ||
+        pthread_create(&warm_audio_thread, &audio_attr, warm_worker_fn,
+                       NULL) != 0) {
+        perror("warm threads");
+        return -1;
+    }
+    warm_running = 1;
+    return 0;
+}
 
-    printf("Playback finished for '%s'. Logs saved.\n", base_name);
+int player_arm(const char *base_name) {
+    if (warm_playing) {
+        if (next_song.staged && strcmp(next_song.name, base_name) == 0)
+            return 0;
+        song_unstage(&next_song);
+    } else if (song.armed) {
+        if (strcmp(song.name, base_name) == 0)
+            return 0;
+        song_disarm();
+    }
+
+    char wav_file[128], pattern_file[128];
+    song_paths(base_name, wav_file, pattern_file, sizeof(wav_file));
+    if (access(wav_file, R_OK) != 0) {
+        fprintf(stderr, "Cannot arm '%s': %s missing\n", base_name, wav_file);
+        return -1;
+    }
+
+    // A broken file must not end the show that is playing
+    jmp_buf trap;
+    if (setjmp(trap)) {
+        load_set_trap(NULL);
+        load_set_target(NULL);
+        song_unstage(&next_song);
+        fprintf(stderr, "Cannot arm '%s'\n", base_name);
+        return -1;
+    }
+    load_set_trap(&trap);
+    song_stage(base_name, &next_song);
+    load_set_trap(NULL);
+
+    if (warm_playing) {
+        printf("Armed '%s' to follow '%s'\n", base_name, song.name);
+        return 0;
+    }
+    song_ready(&next_song);
+    printf("Armed '%s'\n", base_name);
+    return 0;
+}
+
+const char *player_armed_song(void) {
+    if (warm_playing)
+        return next_song.staged ? next_song.name : NULL;
+    return song.armed ? song.name : NULL;
+}
+
+int player_playing(void) {
+    return warm_playing;
+}
+
+int player_start(struct timespec trigger) {
+    if (!warm_running || !song.armed || warm_playing)
+        return -1;
+
+    trigger_time = trigger;
+    __atomic_store_n(&warm_done, 0, __ATOMIC_RELAXED);
+    warm_playing = 1;
+
+    song_launch();
+    __atomic_add_fetch(&warm_gen, 1, __ATOMIC_RELEASE);
+    futex_wake(&warm_gen);
+
+    // Off the start path; the sender still sends a frame the LED thread
+    // published before it ran, the rings hold records until the writer
+    // runs
+    dmx_start();
+    udp_control_start();
+    telemetry_start();
+
+    printf("\n=== Started '%s' ===\n", song.name);
+    return 0;
+}
+
+void player_stop(void) {
+    if (warm_playing)
+        __atomic_store_n(&show_stop, 1, __ATOMIC_RELAXED);
+}
+
+int player_done_fd(void) {
+    return warm_done_fd;
+}
+
+void player_finish(void) {
+    if (!warm_playing)
+        return;
+
+    eventfd_t done;
+    eventfd_read(warm_done_fd, &done);
+    song_finish(1);
+    warm_playing = 0;
+
+    if (next_song.staged) {
+        song_ready(&next_song);
+        printf("Armed '%s'\n", song.name);
+    }
+}
+
+void player_warm_shutdown(void) {
+    song_unstage(&next_song);
+    if (warm_playing) {
+        player_stop();
+        player_finish();
+    }
+    if (song.armed)
+        song_disarm();
+    if (!warm_running)
+        return;
+
+    __atomic_store_n(&warm_quit, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&warm_gen, 1, __ATOMIC_RELEASE);
+    futex_wake(&warm_gen);
+    pthread_join(warm_led_thread, NULL);
+    pthread_join(warm_audio_thread, NULL);
+    warm_running = 0;
+    close(warm_done_fd);
+    warm_done_fd = -1;
+    alsa_close();
 }
@@ -0,0 +1,482 @@
+﻿#include "prep.h"
+#include "load.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+typedef enum {
+    PREP_PENDING = 0,
+    PREP_DONE,         // (re)computed
+    PREP_UNCHANGED,    // mtimes as recorded
+    PREP_TOUCHED,      // new mtime, same content: record updated
+    PREP_FAILED
+} PrepStatus;
+
+typedef struct {
+    char base[128];
+    char wav[384], pattern[384], out[384];
+    off_t wav_size;
+    PrepStatus status;
+    uint64_t bytes;          // audio read for hashing and scanning
+    int worker;
+} PrepTask;
+
+static PrepTask tasks[PREP_MAX_SONGS];
+static int task_count;
+
+// --------------------------------------------------------------
+// Work-stealing pool: every worker owns a deque of task indices, pops
+// its own work from the bottom and steals from the top of the others.
+// Tasks are whole songs, so a mutex per deque is contention-free enough.
+// --------------------------------------------------------------
+typedef struct {
+    pthread_t thread;
+    int id;
+    pthread_mutex_t lock;
+    int items[PREP_MAX_SONGS];
+    int top, bottom;         // valid: [top, bottom)
+    unsigned long done, steals;
+} Worker;
+
+static Worker workers[PREP_MAX_WORKERS];
+static int worker_count;
+
+// The pattern parsers fill the global patterns[] table
+static pthread_mutex_t parse_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int deque_pop(Worker *w) {
+    int t = -1;
+    pthread_mutex_lock(&w->lock);
+    if (w->bottom > w->top)
+        t = w->items[--w->bottom];
+    pthread_mutex_unlock(&w->lock);
+    return t;
+}
+
+static int deque_steal(Worker *w) {
+    int t = -1;
+    pthread_mutex_lock(&w->lock);
+    if (w->bottom > w->top)
+        t = w->items[w->top++];
+    pthread_mutex_unlock(&w->lock);
+    return t;
+}
+
+// --------------------------------------------------------------
+// Per-song work
+// --------------------------------------------------------------
+static uint64_t fnv1a(const uint8_t *p, size_t len, uint64_t h) {
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+
+static uint64_t hash_file(const char *name) {
+    FILE *f = fopen(name, "rb");
+    if (!f)
+        return 0;
+    uint8_t buf[16384];
+    uint64_t h = FNV_OFFSET;
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        h = fnv1a(buf, n, h);
+    fclose(f);
+    return h;
+}
+
+typedef struct {
+    long long size, mtime;
+    unsigned long long hash;
+} FileStamp;
+
+static void stamp_file(const char *name, FileStamp *fs) {
+    struct stat st;
+    memset(fs, 0, sizeof(*fs));
+    if (name[0] && stat(name, &st) == 0) {
+        fs->size = st.st_size;
+        fs->mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    }
+}
+
+// First two lines of an existing result: the recorded file stamps
+static int read_stamps(const char *out, FileStamp *wav, FileStamp *pat) {
+    FILE *f = fopen(out, "r");
+    if (!f)
+        return -1;
+    char line[512];
+    int ok = fgets(line, sizeof(line), f) &&              // header comment
+             fgets(line, sizeof(line), f) &&
+             sscanf(line, "wav %*s %lld %lld %llx", &wav->size,
+                    &wav->mtime, &wav->hash) == 3 &&
+             fgets(line, sizeof(line), f) &&
+             sscanf(line, "pattern %*s %lld %lld %llx", &pat->size,
+                    &pat->mtime, &pat->hash) == 3;
+    fclose(f);
+    return ok ? 0 : -1;
+}
+
+static const char *file_part(const char *path) {
+    const char *s = strrchr(path, '/');
+    return s ? s + 1 : path;
+}
+
+static void write_stamps(FILE *f, const PrepTask *t, const FileStamp *wav,
+                         const FileStamp *pat) {
+    fprintf(f, "# sequencer prep v1\n");
+    fprintf(f, "wav %s %lld %lld %016llx\n", file_part(t->wav),
+            wav->size, wav->mtime, wav->hash);
+    fprintf(f, "pattern %s %lld %lld %016llx\n",
+            t->pattern[0] ? file_part(t->pattern) : "-",
+            pat->size, pat->mtime, pat->hash);
+}
+
+// Replace out with the finished tmp file. Readers see the old result or
+// the complete new one, never a mix, also after a power loss.
+static int replace_prep(FILE *f, const char *tmp, const char *out) {
+    int ok = fflush(f) == 0 && fsync(fileno(f)) == 0;
+    if (fclose(f) != 0)
+        ok = 0;
+    if (!ok || rename(tmp, out) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// Same content under a new mtime: keep the results, refresh the stamps
+static int restamp(const PrepTask *t, const FileStamp *wav,
+                   const FileStamp *pat) {
+    char tmp[400];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", t->out);
+
+    FILE *in = fopen(t->out, "r");
+    FILE *f = fopen(tmp, "w");
+    if (!in || !f) {
+        if (in) fclose(in);
+        if (f) fclose(f);
+        return -1;
+    }
+    write_stamps(f, t, wav, pat);
+
+    char line[512];
+    for (int i = 0; fgets(line, sizeof(line), in); ++i)
+        if (i >= 3)
+            fputs(line, f);
+    fclose(in);
+
+    return replace_prep(f, tmp, t->out);
+}
+
+static void prep_song(PrepTask *t) {
+    FileStamp wav_st, pat_st, old_wav, old_pat;
+    stamp_file(t->wav, &wav_st);
+    stamp_file(t->pattern, &pat_st);
+
+    int have_old = read_stamps(t->out, &old_wav, &old_pat) == 0;
+    if (have_old && old_wav.size == wav_st.size &&
+        old_wav.mtime == wav_st.mtime && old_pat.size == pat_st.size &&
+        old_pat.mtime == pat_st.mtime) {
+        t->status = PREP_UNCHANGED;
+        return;
+    }
+
+    jmp_buf trap;
+    static __thread WavData w;
+    static __thread int parsing;
+    static __thread Pattern *steps;
+
+    if (setjmp(trap)) {
+        // Loader error: message already printed
+        if (parsing) {
+            parsing = 0;
+            pthread_mutex_unlock(&parse_lock);
+        }
+        free_wav_mmap(&w);
+        free(steps);
+        steps = NULL;
+        load_set_trap(NULL);
+        remove(t->out);     // a stale result must not look valid
+        fprintf(stderr, "%s: failed\n", t->base);
+        t->status = PREP_FAILED;
+        return;
+    }
+    load_set_trap(&trap);
+
+    w = load_wav_mmap(t->wav);
+    if (w.frames == 0) {
+        fprintf(stderr, "%s: no audio frames\n", t->base);
+        longjmp(trap, 1);
+    }
+    wav_st.hash = fnv1a(w.mapping, w.mapping_size, FNV_OFFSET);
+    pat_st.hash = t->pattern[0] ? hash_file(t->pattern) : 0;
+    t->bytes = w.mapping_size;
+
+    if (have_old && old_wav.hash == wav_st.hash &&
+        old_pat.hash == pat_st.hash && restamp(t, &wav_st, &pat_st) == 0) {
+        free_wav_mmap(&w);
+        load_set_trap(NULL);
+        t->status = PREP_TOUCHED;
+        return;
+    }
+
+    // Timeline, exactly as the player compiles it
+    pthread_mutex_lock(&parse_lock);
+    parsing = 1;
+    if (load_wav_cues(&w) <= 0) {
+        if (!t->pattern[0]) {
+            fprintf(stderr, "%s: no pattern file and no LED cues\n", t->base);
+            longjmp(trap, 1);
+        }
+        load_patterns(t->pattern, w.sample_rate);
+    }
+    int count = pattern_count;
+    double end_ideal_s = pattern_end_ideal_s;
+    steps = malloc((count ? count : 1) * sizeof(Pattern));
+    memcpy(steps, patterns, count * sizeof(Pattern));
+    parsing = 0;
+    pthread_mutex_unlock(&parse_lock);
+
+    if (count == 0) {
+        fprintf(stderr, "%s: no steps\n", t->base);
+        longjmp(trap, 1);
+    }
+
+    load_set_trap(NULL);
+
+    int short_steps = 0;
+    for (int i = 0; i < count; ++i)
+        if ((steps[i].end_frame - steps[i].start_frame) * 1000 <
+            70ull * w.sample_rate)
+            short_steps++;
+    double end_s = (double)steps[count - 1].end_frame / w.sample_rate;
+    double track_s = (double)w.frames / w.sample_rate;
+
+    char tmp[400];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", t->out);
+    FILE *f = fopen(tmp, "w");
+    if (!f) {
+        perror(tmp);
+        free(steps);
+        steps = NULL;
+        free_wav_mmap(&w);
+        t->status = PREP_FAILED;
+        return;
+    }
+
+    write_stamps(f, t, &wav_st, &pat_st);
+    fprintf(f, "format %u Hz %u ch %zu frames %.3f s\n",
+            w.sample_rate, w.channels, w.frames, track_s);
+    fprintf(f, "steps %d end %.3f s drift %.3f ms track_end %+.3f s "
+            "short %d\n", count, end_s, (end_s - end_ideal_s) * 1000.0,
+            end_s - track_s, short_steps);
+
+    // start_frame end_frame levels fade sfx gain
+    for (int i = 0; i < count; ++i) {
+        const Pattern *p = &steps[i];
+        fprintf(f, "step %llu %llu ", (unsigned long long)p->start_frame,
+                (unsigned long long)p->end_frame);
+        for (int j = 0; j < 8; ++j)
+            fprintf(f, "%02x", p->level[j]);
+        fprintf(f, " %u %d %u\n", p->fade, p->sfx, p->sfx_gain);
+    }
+
+    // Peak and RMS over all channels, PREP_ENVELOPE_MS windows
+    size_t win = (size_t)w.sample_rate * PREP_ENVELOPE_MS / 1000;
+    size_t windows = (w.frames + win - 1) / win;
+    long peak_all = 0, clipped = 0;
+    double sq_all = 0.0;
+
+    fprintf(f, "envelope %d ms %zu\n", PREP_ENVELOPE_MS, windows);
+    for (size_t k = 0; k < windows; ++k) {
+        size_t from = k * win, to = from + win;
+        if (to > w.frames) to = w.frames;
+        const int16_t *s = w.pcm + from * w.channels;
+        size_t n = (to - from) * w.channels;
+
+        long peak = 0;
+        double sq = 0.0;
+        for (size_t i = 0; i < n; ++i) {
+            long v = s[i] < 0 ? -(long)s[i] : s[i];
+            if (v > peak) peak = v;
+            if (v >= 32767) clipped++;
+            sq += (double)s[i] * s[i];
+        }
+        sq_all += sq;
+        if (peak > peak_all) peak_all = peak;
+        fprintf(f, "%ld %ld\n", peak, lround(sqrt(sq / (n ? n : 1))));
+    }
+
+    size_t total = w.frames * w.channels;
+    fprintf(f, "level peak %.1f dBFS rms %.1f dBFS clipped %ld\n",
+            peak_all ? 20.0 * log10(peak_all / 32768.0) : -99.0,
+            sq_all > 0 ? 10.0 * log10(sq_all / (total ? total : 1) /
+                                      (32768.0 * 32768.0)) : -99.0,
+            clipped);
+
+    free(steps);
+    steps = NULL;
+    free_wav_mmap(&w);
+
+    if (replace_prep(f, tmp, t->out) != 0) {
+        perror(t->out);
+        t->status = PREP_FAILED;
+        return;
+    }
+
+    if (short_steps || fabs(end_s - track_s) > 1.0 || clipped)
+        fprintf(stderr, "%s: %d short steps, patterns end %+.3f s from "
+                "track end, %ld clipped samples\n", t->base, short_steps,
+                end_s - track_s, clipped);
+    t->status = PREP_DONE;
+}
+
+static void *worker_fn(void *arg) {
+    Worker *w = arg;
+
+    while (1) {
+        int t = deque_pop(w);
+        for (int k = 1; t < 0 && k < worker_count; ++k) {
+            t = deque_steal(&workers[(w->id + k) % worker_count]);
+            if (t >= 0)
+                w->steals++;
+        }
+        // No task spawns new ones: all deques empty means done
+        if (t < 0)
+            break;
+
+        tasks[t].worker = w->id;
+        prep_song(&tasks[t]);
+        w->done++;
+    }
+    return NULL;
+}
+
+// --------------------------------------------------------------
+// Library scan
+// --------------------------------------------------------------
+static int by_size_desc(const void *a, const void *b) {
+    const PrepTask *x = a, *y = b;
+    return (x->wav_size < y->wav_size) - (x->wav_size > y->wav_size);
+}
+
+static int scan_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        perror(dir);
+        return -1;
+    }
+
+    const char *sep = dir[0] && dir[strlen(dir) - 1] == '/' ? "" : "/";
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        size_t len = strlen(e->d_name);
+        if (len <= 4 || len - 4 >= sizeof(tasks[0].base) ||
+            strcmp(e->d_name + len - 4, ".wav") != 0)
+            continue;
+        if (task_count >= PREP_MAX_SONGS) {
+            fprintf(stderr, "More than %d songs, rest skipped\n",
+                    PREP_MAX_SONGS);
+            break;
+        }
+
+        char base[sizeof(tasks[0].base)];
+        snprintf(base, sizeof(base), "%.*s", (int)(len - 4), e->d_name);
+
+        PrepTask *t = &tasks[task_count++];
+        memset(t, 0, sizeof(*t));
+        strcpy(t->base, base);
+        snprintf(t->wav, sizeof(t->wav), "%s%s%s", dir, sep, e->d_name);
+        snprintf(t->out, sizeof(t->out), "%s%s%s" PREP_EXT, dir, sep, base);
+
+        // Pattern file as the player picks it (.beat, else .txt); embedded
+        // cues still take precedence over either when the WAV has them
+        snprintf(t->pattern, sizeof(t->pattern), "%s%s%s.beat",
+                 dir, sep, base);
+        if (access(t->pattern, R_OK) != 0) {
+            snprintf(t->pattern, sizeof(t->pattern), "%s%s%s.txt",
+                     dir, sep, base);
+            if (access(t->pattern, R_OK) != 0)
+                t->pattern[0] = '\0';
+        }
+
+        struct stat st;
+        if (stat(t->wav, &st) == 0)
+            t->wav_size = st.st_size;
+    }
+    closedir(d);
+    return 0;
+}
+
+int prep_library(const char *dir, int jobs) {
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    task_count = 0;
+    if (scan_dir(dir) != 0)
+        return -1;
+    if (task_count == 0) {
+        printf("No songs in %s\n", dir);
+        return 0;
+    }
+
+    if (jobs <= 0)
+        jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs < 1) jobs = 1;
+    if (jobs > PREP_MAX_WORKERS) jobs = PREP_MAX_WORKERS;
+    if (jobs > task_count) jobs = task_count;
+    worker_count = jobs;
+
+    // Largest first, dealt round robin: stealing evens out the tail
+    qsort(tasks, task_count, sizeof(PrepTask), by_size_desc);
+    for (int i = 0; i < worker_count; ++i) {
+        Worker *w = &workers[i];
+        memset(w, 0, sizeof(*w));
+        w->id = i;
+        pthread_mutex_init(&w->lock, NULL);
+    }
+    // Owners pop from the bottom: push in reverse so the largest go first
+    for (int i = task_count - 1; i >= 0; --i) {
+        Worker *w = &workers[i % worker_count];
+        w->items[w->bottom++] = i;
+    }
+
+    for (int i = 0; i < worker_count; ++i)
+        pthread_create(&workers[i].thread, NULL, worker_fn, &workers[i]);
+    for (int i = 0; i < worker_count; ++i)
+        pthread_join(workers[i].thread, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double wall = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    int count[PREP_FAILED + 1] = {0};
+    uint64_t bytes = 0;
+    for (int i = 0; i < task_count; ++i) {
+        count[tasks[i].status]++;
+        bytes += tasks[i].bytes;
+    }
+
+    printf("%d songs: %d prepared, %d unchanged, %d restamped, %d failed\n",
+           task_count, count[PREP_DONE], count[PREP_UNCHANGED],
+           count[PREP_TOUCHED], count[PREP_FAILED]);
+    printf("%.2f s with %d workers: %.1f songs/s, %.1f MB/s audio\n",
+           wall, worker_count, wall > 0 ? task_count / wall : 0.0,
+           wall > 0 ? bytes / 1e6 / wall : 0.0);
+    for (int i = 0; i < worker_count; ++i)
+        printf("  worker %d: %lu songs, %lu stolen\n",
+               i, workers[i].done, workers[i].steals);
+
+    return count[PREP_FAILED];
+}
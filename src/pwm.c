@@ -0,0 +1,103 @@
+﻿#include "pwm.h"
+#include <string.h>
+
+// --------------------------------------------------------------
+// Timing
+// --------------------------------------------------------------
+
+// Refresh period rounded down to a whole number of LSB units, so the
+// per-cycle timeline advances by an exact integer and never drifts.
+static uint32_t pwm_unit_ns(void) {
+    return 1000000000u / PWM_REFRESH_HZ / ((1u << PWM_BITS) - 1);
+}
+
+uint32_t pwm_frame_ns(void) {
+    return pwm_unit_ns() * ((1u << PWM_BITS) - 1);
+}
+
+// --------------------------------------------------------------
+// Fade curves
+// --------------------------------------------------------------
+int pwm_parse_fade(const char *name) {
+    if (strcmp(name, "lin") == 0)    return FADE_LINEAR;
+    if (strcmp(name, "in") == 0)     return FADE_IN;
+    if (strcmp(name, "out") == 0)    return FADE_OUT;
+    if (strcmp(name, "smooth") == 0) return FADE_SMOOTH;
+    if (strcmp(name, "step") == 0)   return FADE_NONE;
+    return -1;
+}
+
+// Curve value for progress p, both in Q16 (0..65536).
+static uint32_t fade_curve_q16(int curve, uint32_t p) {
+    uint32_t q;
+    switch (curve) {
+    case FADE_LINEAR:
+        return p;
+    case FADE_IN:
+        return (uint32_t)(((uint64_t)p * p) >> 16);
+    case FADE_OUT:
+        q = 65536 - p;
+        return 65536 - (uint32_t)(((uint64_t)q * q) >> 16);
+    case FADE_SMOOTH:
+        // 3p^2 - 2p^3
+        q = (uint32_t)(((uint64_t)p * p) >> 16);
+        return (uint32_t)((3ull * q) - ((2ull * q * p) >> 16));
+    default:
+        return 65536;
+    }
+}
+
+void pwm_fade_levels(uint8_t out[8], const uint8_t from[8], const uint8_t to[8],
+                     int curve, uint64_t pos, uint64_t len) {
+    if (curve == FADE_NONE || len == 0 || pos >= len) {
+        memcpy(out, to, 8);
+        return;
+    }
+
+    uint32_t c = fade_curve_q16(curve, (uint32_t)((pos << 16) / len));
+    for (int j = 0; j < 8; ++j) {
+        int32_t d = (int32_t)to[j] - (int32_t)from[j];
+        out[j] = (uint8_t)(from[j] + ((d * (int32_t)c) / 65536));
+    }
+}
+
+// --------------------------------------------------------------
+// Frame builder
+// --------------------------------------------------------------
+
+// Gamma 2.0 approximation so linear fades look linear to the eye.
+// Cheap enough to run once per frame, no table needed.
+static inline uint8_t pwm_gamma(uint8_t level) {
+    return (uint8_t)(((uint32_t)level * level + 254) / 255);
+}
+
+void pwm_build_frame(PwmFrame *f, const uint8_t levels[8],
+                     const unsigned int *lines) {
+    uint8_t duty[8];
+    for (int j = 0; j < 8; ++j)
+        duty[j] = pwm_gamma(levels[j]);
+
+    const uint32_t unit = pwm_unit_ns();
+    f->count = 0;
+
+    // MSB plane first: it is always the longest slot, which gives the
+    // RT loop time to build the next frame right after its first write.
+    for (int b = PWM_BITS - 1; b >= 0; --b) {
+        uint32_t set_mask = 0, clr_mask = 0;
+        for (int j = 0; j < 8; ++j) {
+            if ((duty[j] >> b) & 1) set_mask |= (1u << lines[j]);
+            else                    clr_mask |= (1u << lines[j]);
+        }
+
+        uint32_t ns = unit << b;
+
+        // Merge consecutive planes that write the same masks
+        if (f->count > 0 &&
+            f->slot[f->count - 1].set_mask == set_mask) {
+            f->slot[f->count - 1].duration_ns += ns;
+            continue;
+        }
+
+        f->slot[f->count++] = (PwmSlot){set_mask, clr_mask, ns};
+    }
+}
@@ -5,6 +5,9 @@
 #define AUDIO_PERIOD_FRAMES 441
 
 snd_pcm_t *pcm = NULL;
+static unsigned int open_rate, open_channels;
+// avail_min before alsa_wake_at_delay changed it, 0 = unchanged
+static snd_pcm_uframes_t saved_avail_min;
 
 void setup_alsa(unsigned int sample_rate, unsigned int channels) {
     snd_pcm_hw_params_t *params;
@@ -42,6 +45,61 @@ void setup_alsa(unsigned int sample_rate, unsigned int channels) {
     // Re-prepare device again to reset buffer pointers
     snd_pcm_drop(pcm);
     snd_pcm_prepare(pcm);
+
+    open_rate = sample_rate;
+    open_channels = channels;
+    saved_avail_min = 0;
+}
+
+// Keeps the device open across songs of the same format
+void alsa_ensure(unsigned int sample_rate, unsigned int channels) {
+    if (pcm && open_rate == sample_rate && open_channels == channels)
+        return;
+    alsa_close();
+    setup_alsa(sample_rate, channels);
+}
+
+// Let the song play out, then leave the device prepared for the next
+void alsa_rearm(void) {
+    if (pcm) {
+        snd_pcm_drain(pcm);
+        snd_pcm_prepare(pcm);
+    }
+}
+
+// Let the PCM poll descriptors signal only once no more than
+// delay_frames are left queued, instead of whenever a period is free.
+int alsa_wake_at_delay(snd_pcm_uframes_t delay_frames) {
+    snd_pcm_uframes_t buffer_size, period_size;
+    snd_pcm_sw_params_t *sw;
+
+    if (snd_pcm_get_params(pcm, &buffer_size, &period_size) < 0 ||
+        delay_frames >= buffer_size)
+        return -1;
+
+    snd_pcm_sw_params_malloc(&sw);
+    snd_pcm_sw_params_current(pcm, sw);
+    if (!saved_avail_min)
+        snd_pcm_sw_params_get_avail_min(sw, &saved_avail_min);
+    snd_pcm_sw_params_set_avail_min(pcm, sw, buffer_size - delay_frames);
+    int err = snd_pcm_sw_params(pcm, sw);
+    snd_pcm_sw_params_free(sw);
+    return err;
+}
+
+// Back to the wakeup level the device was opened with, so a song fed by
+// the audio thread on the same open PCM (warm mode) is not affected
+void alsa_wake_restore(void) {
+    snd_pcm_sw_params_t *sw;
+
+    if (!pcm || !saved_avail_min)
+        return;
+    snd_pcm_sw_params_malloc(&sw);
+    snd_pcm_sw_params_current(pcm, sw);
+    snd_pcm_sw_params_set_avail_min(pcm, sw, saved_avail_min);
+    if (snd_pcm_sw_params(pcm, sw) == 0)
+        saved_avail_min = 0;
+    snd_pcm_sw_params_free(sw);
 }
 
 void alsa_close(void) {
@@ -0,0 +1,93 @@
+﻿#include "status.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static StatusPage local_page;
+StatusPage *status = &local_page;
+
+int status_open(void) {
+    int fd = shm_open(STATUS_SHM_NAME, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        perror("shm_open");
+        return -1;
+    }
+    // Readable by monitors running as other users
+    fchmod(fd, 0644);
+
+    if (ftruncate(fd, sizeof(StatusPage)) != 0) {
+        perror("ftruncate");
+        close(fd);
+        return -1;
+    }
+
+    void *p = mmap(NULL, sizeof(StatusPage), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap status");
+        return -1;
+    }
+
+    // No page faults in the RT threads on first publish
+    memset(p, 0, sizeof(StatusPage));
+    if (mlock(p, sizeof(StatusPage)) != 0)
+        syslog(LOG_WARNING, "mlock of status page failed\n");
+
+    status = p;
+    status->version = STATUS_VERSION;
+    __atomic_store_n(&status->magic, STATUS_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void status_close(void) {
+    if (status == &local_page)
+        return;
+
+    __atomic_store_n(&status->magic, 0, __ATOMIC_RELEASE);
+    munmap(status, sizeof(StatusPage));
+    shm_unlink(STATUS_SHM_NAME);
+    status = &local_page;
+}
+
+void status_song_begin(const char *song, uint32_t sample_rate,
+                       uint64_t total_frames, int pattern_count,
+                       struct timespec start) {
+    StatusShow *s = &status->show;
+
+    status_write_begin(&s->seq);
+    s->playing = 1;
+    snprintf(s->song, sizeof(s->song), "%s", song);
+    s->sample_rate = sample_rate;
+    s->total_frames = total_frames;
+    s->pattern_count = pattern_count;
+    s->start_ns = status_ns(start);
+    status_write_end(&s->seq);
+
+    // The RT threads are not running yet, reset their blocks here
+    status_write_begin(&status->led.seq);
+    status->led.pattern_index = 0;
+    status->led.jitter_us = 0;
+    status->led.late = status->led.missed = 0;
+    status->led.update_ns = s->start_ns;
+    status_write_end(&status->led.seq);
+
+    status_write_begin(&status->audio.seq);
+    status->audio.frame_pos = 0;
+    status->audio.alsa_delay = 0;
+    status->audio.jitter_us = 0;
+    status->audio.underruns = 0;
+    status->audio.late = status->audio.missed = 0;
+    status->audio.update_ns = s->start_ns;
+    status_write_end(&status->audio.seq);
+}
+
+void status_song_end(void) {
+    status_write_begin(&status->show.seq);
+    status->show.playing = 0;
+    status_write_end(&status->show.seq);
+}
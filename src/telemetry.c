@@ -0,0 +1,191 @@
+﻿#include "telemetry.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/mman.h>
+
+#define TEL_RING_SIZE   4096    // records per producer, power of two
+#define TEL_FLUSH_MS    100
+
+// Single producer (one RT thread), single consumer (the writer)
+typedef struct {
+    TelRecord rec[TEL_RING_SIZE];
+    uint32_t head;       // written by the producer
+    uint32_t tail;       // written by the writer
+    uint32_t dropped;
+} TelRing;
+
+static TelRing audio_ring, led_ring;
+static int tel_fd = -1;
+static int writer_running = 0;
+static int session_open = 0;
+static pthread_t writer_thread;
+static TelSession header;    // written by the writer once the show starts
+
+static uint16_t sat16(long v) {
+    return v < 0 ? 0 : v > 0xFFFF ? 0xFFFF : (uint16_t)v;
+}
+
+static void ring_push(TelRing *r, const TelRecord *rec) {
+    uint32_t head = r->head;
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= TEL_RING_SIZE) {
+        __atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    r->rec[head & (TEL_RING_SIZE - 1)] = *rec;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void write_all(const void *buf, size_t len) {
+    const uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = write(tel_fd, p, len);
+        if (n <= 0) {
+            syslog(LOG_WARNING, "telemetry write failed\n");
+            return;
+        }
+        p += n;
+        len -= n;
+    }
+}
+
+// Both contiguous runs of the ring in at most two writes
+static void ring_drain(TelRing *r) {
+    uint32_t tail = r->tail;
+    uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+    while (tail != head) {
+        uint32_t at = tail & (TEL_RING_SIZE - 1);
+        uint32_t n = head - tail;
+        if (n > TEL_RING_SIZE - at)
+            n = TEL_RING_SIZE - at;
+        write_all(&r->rec[at], n * sizeof(TelRecord));
+        tail += n;
+    }
+    __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+}
+
+static void *writer_fn(void *arg) {
+    struct timespec pause = { 0, TEL_FLUSH_MS * 1000000L };
+
+    write_all(&header, sizeof(header));
+    while (__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) {
+        ring_drain(&audio_ring);
+        ring_drain(&led_ring);
+        nanosleep(&pause, NULL);
+    }
+    ring_drain(&audio_ring);
+    ring_drain(&led_ring);
+    return NULL;
+}
+
+int telemetry_open(const char *path) {
+    tel_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (tel_fd < 0) {
+        perror("telemetry open");
+        return -1;
+    }
+
+    // Rings resident before the RT threads touch them
+    memset(&audio_ring, 0, sizeof(audio_ring));
+    memset(&led_ring, 0, sizeof(led_ring));
+    mlock(&audio_ring, sizeof(audio_ring));
+    mlock(&led_ring, sizeof(led_ring));
+    return 0;
+}
+
+void telemetry_close(void) {
+    if (tel_fd >= 0) {
+        close(tel_fd);
+        tel_fd = -1;
+    }
+}
+
+void telemetry_begin(const char *song, uint32_t sample_rate, TelMode mode) {
+    if (tel_fd < 0)
+        return;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TEL_MAGIC, 4);
+    header.version = TEL_VERSION;
+    header.record_size = sizeof(TelRecord);
+    header.sample_rate = sample_rate;
+    header.mode = mode;
+    snprintf(header.song, sizeof(header.song), "%s", song);
+
+    audio_ring.head = audio_ring.tail = audio_ring.dropped = 0;
+    led_ring.head = led_ring.tail = led_ring.dropped = 0;
+    session_open = 1;
+}
+
+void telemetry_start(void) {
+    if (!session_open || writer_running)
+        return;
+
+    header.wall_time = time(NULL);
+
+    // Plain SCHED_OTHER: file I/O never competes with the RT threads
+    __atomic_store_n(&writer_running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&writer_thread, NULL, writer_fn, NULL) != 0) {
+        perror("telemetry writer");
+        writer_running = 0;
+        session_open = 0;
+    }
+}
+
+void telemetry_end(uint32_t show_us, int underruns) {
+    if (!session_open || !writer_running)
+        return;
+
+    __atomic_store_n(&writer_running, 0, __ATOMIC_RELEASE);
+    pthread_join(writer_thread, NULL);
+    session_open = 0;
+
+    uint32_t dropped = audio_ring.dropped + led_ring.dropped;
+    TelRecord end = {
+        .t_us = show_us,
+        .type = TEL_END,
+        .arg = sat16(dropped),
+        .underruns = underruns
+    };
+    write_all(&end, sizeof(end));
+    fdatasync(tel_fd);
+
+    if (dropped)
+        syslog(LOG_WARNING, "telemetry: %u records dropped\n", dropped);
+}
+
+void telemetry_cancel(void) {
+    // Nothing was played, so nothing was written
+    session_open = 0;
+}
+
+void tel_audio(uint32_t t_us, uint8_t flags, long delay_frames,
+               long jitter_us, long write_us, long mix_us) {
+    if (!session_open)
+        return;
+
+    TelRecord r = {
+        .t_us = t_us, .type = TEL_AUDIO, .flags = flags,
+        .arg = sat16(delay_frames), .jitter_us = jitter_us,
+        .write_us = sat16(write_us), .mix_us = sat16(mix_us)
+    };
+    ring_push(&audio_ring, &r);
+}
+
+void tel_led(uint32_t t_us, uint8_t flags, int index,
+             long jitter_us, long write_us) {
+    if (!session_open)
+        return;
+
+    TelRecord r = {
+        .t_us = t_us, .type = TEL_LED, .flags = flags,
+        .arg = sat16(index), .jitter_us = jitter_us,
+        .write_us = sat16(write_us)
+    };
+    ring_push(&led_ring, &r);
+}
@@ -1,11 +1,17 @@
 ﻿#include "player.h"
 #include "udp.h"
+#include "mixer.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <syslog.h>
+#include <time.h>
 
 int receive_udp_song(char *song_out, size_t len) {
     int sock = socket(AF_INET, SOCK_DGRAM, 0);
@@ -79,3 +85,211 @@ void emulate_udp_from_file(const char *filename) {
 
     fclose(f);
 }
+
+// --------------------------------------------------------------
+// Control channel during playback
+// --------------------------------------------------------------
+static pthread_t control_thread;
+static int control_sock = -1;
+static int control_running = 0;
+
+static void handle_control(const char *buf) {
+    char name[MIX_NAME_LEN];
+    char *p = strstr(buf, "\"sfx\"");
+    if (p && sscanf(p, "\"sfx\"%*[: ]\"%31[^\"]\"", name) == 1) {
+        int gain = 100;
+        char *g = strstr(buf, "\"gain\"");
+        if (g) sscanf(g, "\"gain\"%*[: ]%d", &gain);
+        if (gain < 0) gain = 0;
+        if (gain > 100) gain = 100;
+
+        if (mixer_trigger(mixer_find(name),
+                          (int16_t)(SFX_GAIN_UNITY * gain / 100)) != 0)
+            syslog(LOG_WARNING, "sfx '%s' not triggered\n", name);
+        return;
+    }
+    syslog(LOG_WARNING, "Unknown control command: %s\n", buf);
+}
+
+static void *control_thread_fn(void *arg) {
+    char buf[256];
+    while (__atomic_load_n(&control_running, __ATOMIC_ACQUIRE)) {
+        ssize_t n = recv(control_sock, buf, sizeof(buf) - 1, 0);
+        if (n <= 0)
+            continue;   // timeout, re-check running flag
+        buf[n] = '\0';
+        handle_control(buf);
+    }
+    return NULL;
+}
+
+void udp_control_start(void) {
+    control_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (control_sock < 0) { perror("control socket"); return; }
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(UDP_CONTROL_PORT);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(control_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("control bind");
+        close(control_sock);
+        control_sock = -1;
+        return;
+    }
+
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 200000 };
+    setsockopt(control_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    __atomic_store_n(&control_running, 1, __ATOMIC_RELEASE);
+    pthread_create(&control_thread, NULL, control_thread_fn, NULL);
+}
+
+void udp_control_stop(void) {
+    if (control_sock < 0)
+        return;
+    __atomic_store_n(&control_running, 0, __ATOMIC_RELEASE);
+    pthread_join(control_thread, NULL);
+    close(control_sock);
+    control_sock = -1;
+}
+
+// --------------------------------------------------------------
+// Warm-start daemon: commands on UDP_PORT, also while a song plays
+//   {"arm":"name"}                  load and open everything ahead
+//                                   (during a song: the one after it)
+//   {"start":1}                     play the armed song now
+//   {"song":"name"}                 arm if needed, then start
+//   ..."next":"name"                arm this one while the song plays
+//   {"stop":1}                      end the playing song
+//   {"quit":1}
+// --------------------------------------------------------------
+// "key":"value" anywhere in buf; out holds MAX_SONG_NAME chars
+static int json_string(const char *buf, const char *key, char *out) {
+    char pat[32];
+    snprintf(pat, sizeof(pat), "\"%s\"", key);
+    const char *p = strstr(buf, pat);
+    if (!p || sscanf(p + strlen(pat), "%*[: ]\"%63[^\"]\"", out) != 1)
+        return -1;
+    return 0;
+}
+
+static void reply(int sock, const struct sockaddr_in *to, const char *msg) {
+    sendto(sock, msg, strlen(msg), 0, (const struct sockaddr *)to,
+           sizeof(*to));
+}
+
+void udp_warm_daemon(const char *first_song) {
+    if (player_warm_init() != 0)
+        return;
+    if (first_song)
+        player_arm(first_song);
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) { perror("socket"); player_warm_shutdown(); return; }
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(UDP_PORT);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        close(sock);
+        player_warm_shutdown();
+        return;
+    }
+
+    printf("Warm daemon listening on UDP port %d\n", UDP_PORT);
+
+    struct pollfd pfd[2] = {
+        { .fd = sock, .events = POLLIN },
+        { .fd = player_done_fd(), .events = POLLIN },
+    };
+    char buf[512], name[MAX_SONG_NAME], next[MAX_SONG_NAME], ack[160];
+    while (1) {
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+        // The song ended: report it, then ready the one armed meanwhile
+        if (pfd[1].revents & POLLIN)
+            player_finish();
+        if (!(pfd[0].revents & POLLIN))
+            continue;
+
+        struct sockaddr_in client = {0};
+        socklen_t clen = sizeof(client);
+        ssize_t n = recvfrom(sock, buf, sizeof(buf) - 1, 0,
+                             (struct sockaddr *)&client, &clen);
+        // Trigger time: right when the command is in hand
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (n <= 0)
+            continue;
+        buf[n] = '\0';
+
+        if (strstr(buf, "\"quit\"")) {
+            reply(sock, &client, "{\"ack\":\"quit\"}");
+            break;
+        }
+        if (strstr(buf, "\"stop\"")) {
+            player_stop();
+            reply(sock, &client, "{\"ack\":\"stop\"}");
+            continue;
+        }
+
+        int have_next = json_string(buf, "next", next) == 0;
+        int start = strstr(buf, "\"start\"") != NULL;
+
+        if (json_string(buf, "song", name) == 0) {
+            start = 1;
+        } else if (json_string(buf, "arm", name) != 0) {
+            name[0] = '\0';
+            if (!start) {
+                syslog(LOG_WARNING, "Unknown command: %s\n", buf);
+                reply(sock, &client, "{\"ack\":\"error\"}");
+                continue;
+            }
+        }
+
+        // One song at a time; leave the one queued behind it alone
+        if (start && player_playing()) {
+            reply(sock, &client, "{\"ack\":\"error\",\"reason\":\"busy\"}");
+            continue;
+        }
+
+        if (name[0] && player_arm(name) != 0) {
+            snprintf(ack, sizeof(ack),
+                     "{\"ack\":\"error\",\"song\":\"%s\"}", name);
+            reply(sock, &client, ack);
+            continue;
+        }
+
+        const char *armed = player_armed_song();
+        if (!start) {
+            snprintf(ack, sizeof(ack), "{\"ack\":\"armed\",\"song\":\"%s\"}",
+                     armed ? armed : "");
+            reply(sock, &client, ack);
+            continue;
+        }
+        if (!armed) {
+            reply(sock, &client, "{\"ack\":\"error\",\"reason\":\"nothing armed\"}");
+            continue;
+        }
+
+        // Acknowledge after the start so the reply costs no latency
+        snprintf(ack, sizeof(ack), "{\"ack\":\"started\",\"song\":\"%s\"}",
+                 armed);
+        player_start(now);
+        reply(sock, &client, ack);
+
+        // Loaded while the song plays, ready the moment it ends
+        if (have_next && player_arm(next) != 0)
+            syslog(LOG_WARNING, "Could not arm next song '%s'\n", next);
+    }
+
+    close(sock);
+    player_warm_shutdown();
+}
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Plays a song in both scheduling modes and compares the RT cost.
+# Usage: tools/bench_modes.sh song [runs]   (as root, from the repo root)
+# Jitter is wakeup lateness against the absolute schedule in both modes:
+# the audio thread's 30 ms grid, or the moment the ALSA queue reached the
+# event loop's wakeup level.
+
+song=$1
+runs=${2:-3}
+[ -n "$song" ] || { echo "usage: $0 song [runs]" >&2; exit 1; }
+
+for mode in "" "-1"; do
+    i=0
+    while [ $i -lt "$runs" ]; do
+        ./sequencer $mode "$song" 2>/dev/null | grep '^RT \['
+        i=$((i + 1))
+    done
+done | awk '
+    /CPU/ {
+        m = $2 " " $3
+        sub(/^\[/, "", m); sub(/\]:$/, "", m)
+        cpu[m] += $7; vol[m] += $10; invol[m] += $13; n[m]++
+    }
+    /jitter/ {
+        m = $2 " " $3
+        sub(/^\[/, "", m); sub(/\]:$/, "", m)
+        la[m] += $7; if ($10 > lm[m]) lm[m] = $10
+        aa[m] += $15; if ($18 > am[m]) am[m] = $18
+    }
+    END {
+        printf "%-12s %4s %8s %8s %8s %10s %10s %10s %10s\n", "mode", "runs",
+               "CPU%", "vol cs", "invol cs", "LED avg", "LED max",
+               "audio avg", "audio max"
+        for (m in n)
+            printf "%-12s %4d %8.2f %8.0f %8.0f %8.0fus %8dus %8.0fus %8dus\n",
+                   m, n[m], cpu[m] / n[m], vol[m] / n[m], invol[m] / n[m],
+                   la[m] / n[m], lm[m], aa[m] / n[m], am[m]
+    }'
@@ -0,0 +1,114 @@
+﻿// Local E1.31 / Art-Net listener for checking the sequencer's DMX sink.
+// Prints once per second: frame rate, inter-frame jitter, sequence gaps
+// and the first 8 slots of the last frame.
+//
+//   dmx-listen e131 [universe]     (joins 239.255.x.y)
+//   dmx-listen artnet [universe]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define E131_PORT   5568
+#define ARTNET_PORT 6454
+
+static long now_us(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000L + t.tv_nsec / 1000L;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || (strcmp(argv[1], "e131") && strcmp(argv[1], "artnet"))) {
+        fprintf(stderr, "Usage: %s e131|artnet [universe]\n", argv[0]);
+        return 1;
+    }
+    const int e131 = strcmp(argv[1], "e131") == 0;
+    const int universe = argc > 2 ? atoi(argv[2]) : 1;
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) { perror("socket"); return 1; }
+
+    int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(e131 ? E131_PORT : ARTNET_PORT);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind"); close(sock); return 1;
+    }
+
+    if (e131) {
+        struct ip_mreq mreq = {0};
+        mreq.imr_multiaddr.s_addr = htonl(0xefff0000u | (universe & 0xffff));
+        mreq.imr_interface.s_addr = INADDR_ANY;
+        setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+    }
+
+    const int header = e131 ? 126 : 18;
+    const int seq_offset = e131 ? 111 : 12;
+
+    uint8_t buf[1024];
+    long window_start = now_us(), last_rx = 0;
+    long max_gap = 0, min_gap = -1;
+    unsigned long frames = 0, changes = 0, lost = 0;
+    int last_seq = -1;
+    uint8_t last_slots[8] = {0};
+
+    while (1) {
+        ssize_t n = recv(sock, buf, sizeof(buf), 0);
+        if (n < header + 8)
+            continue;
+
+        int rx_universe = e131 ? (buf[113] << 8) | buf[114]
+                               : ((buf[15] & 0x7f) << 8) | buf[14];
+        if (rx_universe != universe)
+            continue;
+
+        long t = now_us();
+        if (last_rx) {
+            long gap = t - last_rx;
+            if (gap > max_gap) max_gap = gap;
+            if (min_gap < 0 || gap < min_gap) min_gap = gap;
+        }
+        last_rx = t;
+
+        int seq = buf[seq_offset];
+        if (e131) {
+            if (last_seq >= 0 && seq != ((last_seq + 1) & 0xff))
+                lost += (seq - last_seq - 1) & 0xff;
+            last_seq = seq;
+        } else if (seq != 0) {
+            // Art-Net counts 1..255 (0 = sequencing disabled)
+            if (last_seq > 0 && seq != last_seq % 255 + 1)
+                lost += (seq - last_seq - 1 + 255) % 255;
+            last_seq = seq;
+        }
+
+        if (memcmp(last_slots, buf + header, 8) != 0)
+            changes++;
+        memcpy(last_slots, buf + header, 8);
+        frames++;
+
+        if (t - window_start >= 1000000) {
+            double secs = (t - window_start) / 1e6;
+            printf("%.1f fps, %lu changes, gap %.2f..%.2f ms, "
+                   "%lu lost | %02x %02x %02x %02x %02x %02x %02x %02x\n",
+                   frames / secs, changes, min_gap / 1000.0, max_gap / 1000.0,
+                   lost, last_slots[0], last_slots[1], last_slots[2],
+                   last_slots[3], last_slots[4], last_slots[5],
+                   last_slots[6], last_slots[7]);
+            fflush(stdout);
+            window_start = t;
+            frames = changes = lost = 0;
+            max_gap = 0;
+            min_gap = -1;
+        }
+    }
+}
@@ -0,0 +1,129 @@
+﻿// Live view of the sequencer's shared status page. Only reads the
+// mapping, so polling it does not touch the player's RT threads.
+//
+//   sequencer-top [-i interval_ms] [-n]     (-n prints once and exits)
+#include "status.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define STALE_MS 1000   // no update for this long while playing
+
+static const StatusPage *attach(void) {
+    int fd = shm_open(STATUS_SHM_NAME, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+
+    void *p = mmap(NULL, sizeof(StatusPage), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    const StatusPage *page = p;
+    if (__atomic_load_n(&page->magic, __ATOMIC_ACQUIRE) != STATUS_MAGIC ||
+        page->version != STATUS_VERSION) {
+        munmap(p, sizeof(StatusPage));
+        return NULL;
+    }
+    return page;
+}
+
+static int64_t now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return status_ns(t);
+}
+
+static void show(const StatusPage *page, int once) {
+    StatusShow s;
+    StatusLed led;
+    StatusAudio audio;
+
+    status_read(&page->show, &page->show.seq, &s, sizeof(s));
+    status_read(&page->led, &page->led.seq, &led, sizeof(led));
+    status_read(&page->audio, &page->audio.seq, &audio, sizeof(audio));
+
+    int64_t now = now_ns();
+    double rate = s.sample_rate ? s.sample_rate : 44100.0;
+    double pos_s = audio.frame_pos / rate;
+    double total_s = s.total_frames / rate;
+    long led_age = (long)((now - led.update_ns) / 1000000);
+    long audio_age = (long)((now - audio.update_ns) / 1000000);
+
+    if (!once)
+        printf("\033[H\033[J");
+    printf("sequencer-top        %s\n\n",
+           s.playing ? "PLAYING" : "idle");
+    printf("song      %s\n", s.song[0] ? s.song : "-");
+    printf("position  %d:%04.1f / %d:%04.1f  (%.1f%%)  frame %llu\n",
+           (int)pos_s / 60, pos_s - 60 * ((int)pos_s / 60),
+           (int)total_s / 60, total_s - 60 * ((int)total_s / 60),
+           total_s > 0 ? 100.0 * pos_s / total_s : 0.0,
+           (unsigned long long)audio.frame_pos);
+    printf("pattern   %d / %d\n\n", led.pattern_index + 1, s.pattern_count);
+
+    printf("          jitter    late  missed  updated\n");
+    printf("LED     %6d us  %6u  %6u  %5ld ms ago%s\n",
+           led.jitter_us, led.late, led.missed, led_age,
+           s.playing && led_age > STALE_MS ? "  STALE" : "");
+    printf("audio   %6d us  %6u  %6u  %5ld ms ago%s\n",
+           audio.jitter_us, audio.late, audio.missed, audio_age,
+           s.playing && audio_age > STALE_MS ? "  STALE" : "");
+    printf("\nALSA delay %d frames (%.1f ms), underruns %u\n",
+           audio.alsa_delay, audio.alsa_delay * 1000.0 / rate,
+           audio.underruns);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    long interval_ms = 100;
+    int once = 0, opt;
+
+    while ((opt = getopt(argc, argv, "i:n")) != -1) {
+        switch (opt) {
+        case 'i': interval_ms = atol(optarg); break;
+        case 'n': once = 1; break;
+        default:
+            fprintf(stderr, "Usage: %s [-i interval_ms] [-n]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (interval_ms < 1)
+        interval_ms = 1;
+
+    const StatusPage *page = NULL;
+    struct timespec pause = { interval_ms / 1000,
+                              (interval_ms % 1000) * 1000000 };
+
+    while (1) {
+        // The player unlinks the page on exit; pick up a restarted one
+        if (page && __atomic_load_n(&page->magic, __ATOMIC_ACQUIRE) !=
+                    STATUS_MAGIC) {
+            munmap((void *)page, sizeof(StatusPage));
+            page = NULL;
+        }
+        if (!page)
+            page = attach();
+
+        if (page) {
+            show(page, once);
+        } else {
+            if (once) {
+                fprintf(stderr, "sequencer is not running\n");
+                return 1;
+            }
+            printf("\033[H\033[Jwaiting for sequencer...\n");
+            fflush(stdout);
+        }
+
+        if (once)
+            break;
+        nanosleep(&pause, NULL);
+    }
+    return 0;
+}
@@ -0,0 +1,316 @@
+﻿// Summarises sequencer telemetry files and compares them to a baseline.
+//
+//   tel-report [-s song] [-w baseline] [-b baseline] [-t pct] file...
+//
+// One line per session: jitter percentiles of both threads, write
+// latency, underruns and missed boundaries. -w saves the median of every
+// metric per song as the baseline, -b flags sessions that are worse than
+// it by more than -t percent (default 25) and exits with status 2.
+#include "telemetry.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_SESSIONS 4096
+#define MAX_SONGS    256
+#define FLOOR_US     200    // jitter/latency differences below this are noise
+
+enum {
+    M_AUDIO_P50, M_AUDIO_P99, M_AUDIO_MAX,
+    M_LED_P50, M_LED_P99, M_LED_MAX,
+    M_WRITE_P99, M_LED_WRITE_P99, M_MIX_P99,
+    M_UNDERRUNS, M_MISSED,
+    M_COUNT
+};
+
+static const char *metric_names[M_COUNT] = {
+    "audio_jitter_p50", "audio_jitter_p99", "audio_jitter_max",
+    "led_jitter_p50", "led_jitter_p99", "led_jitter_max",
+    "audio_write_p99", "led_write_p99", "mix_p99",
+    "underruns", "missed"
+};
+
+typedef struct {
+    TelSession hdr;
+    int complete;
+    unsigned dropped;
+    double m[M_COUNT];
+} Session;
+
+// Baselines are per song and scheduling mode: "jungle", "jungle@event"
+typedef struct {
+    char song[56];
+    double base[M_COUNT];
+    int has_base;
+} Song;
+
+static Session sessions[MAX_SESSIONS];
+static int session_count;
+static Song songs[MAX_SONGS];
+static int song_count;
+
+// Growable sample buffers reused for every session
+typedef struct { long *v; size_t n, cap; } Samples;
+
+static void push(Samples *s, long v) {
+    if (s->n == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 4096;
+        s->v = realloc(s->v, s->cap * sizeof(long));
+        if (!s->v) { perror("realloc"); exit(1); }
+    }
+    s->v[s->n++] = v;
+}
+
+static int cmp_long(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(Samples *s, double p) {
+    if (s->n == 0)
+        return 0.0;
+    qsort(s->v, s->n, sizeof(long), cmp_long);
+    size_t i = (size_t)(p / 100.0 * (s->n - 1) + 0.5);
+    return s->v[i];
+}
+
+static const char *mode_names[] = { "threads", "event", "pwm" };
+
+static const char *session_key(const Session *s) {
+    static char key[56];
+    if (s->hdr.mode == TEL_MODE_THREADS || s->hdr.mode > TEL_MODE_PWM)
+        snprintf(key, sizeof(key), "%s", s->hdr.song);
+    else
+        snprintf(key, sizeof(key), "%s@%s", s->hdr.song,
+                 mode_names[s->hdr.mode]);
+    return key;
+}
+
+static int is_header(const uint8_t *p, size_t left) {
+    const TelSession *h = (const TelSession *)p;
+    return left >= sizeof(TelSession) && memcmp(h->magic, TEL_MAGIC, 4) == 0 &&
+           h->version == TEL_VERSION && h->record_size == sizeof(TelRecord);
+}
+
+static Song *find_song(const char *name, int create) {
+    for (int i = 0; i < song_count; ++i)
+        if (strncmp(songs[i].song, name, sizeof(songs[i].song)) == 0)
+            return &songs[i];
+    if (!create || song_count >= MAX_SONGS)
+        return NULL;
+    Song *s = &songs[song_count++];
+    memset(s, 0, sizeof(*s));
+    snprintf(s->song, sizeof(s->song), "%s", name);
+    return s;
+}
+
+static void load_file(const char *name, const char *only_song) {
+    FILE *f = fopen(name, "rb");
+    if (!f) { perror(name); exit(1); }
+    fseek(f, 0, SEEK_END);
+    size_t size = ftell(f);
+    rewind(f);
+    uint8_t *buf = malloc(size ? size : 1);
+    if (!buf || fread(buf, 1, size, f) != size) {
+        fprintf(stderr, "%s: read failed\n", name);
+        exit(1);
+    }
+    fclose(f);
+
+    static Samples aj, lj, aw, lw, mx;
+    size_t p = 0;
+
+    while (p < size) {
+        if (!is_header(buf + p, size - p)) {
+            fprintf(stderr, "%s: no session header at offset %zu, stopping\n",
+                    name, p);
+            break;
+        }
+        if (session_count == MAX_SESSIONS) {
+            fprintf(stderr, "%s: more than %d sessions, ignoring the rest\n",
+                    name, MAX_SESSIONS);
+            break;
+        }
+        Session *s = &sessions[session_count];
+        memset(s, 0, sizeof(*s));
+        memcpy(&s->hdr, buf + p, sizeof(TelSession));
+        s->hdr.song[sizeof(s->hdr.song) - 1] = '\0';
+        p += sizeof(TelSession);
+
+        aj.n = lj.n = aw.n = lw.n = mx.n = 0;
+        long underruns = 0, missed = 0;
+
+        while (p + sizeof(TelRecord) <= size && !is_header(buf + p, size - p)) {
+            TelRecord r;
+            memcpy(&r, buf + p, sizeof(r));
+            p += sizeof(r);
+
+            if (r.type == TEL_AUDIO) {
+                push(&aj, r.jitter_us);
+                push(&aw, r.write_us);
+                push(&mx, r.mix_us);
+                underruns += (r.flags & TEL_F_UNDERRUN) != 0;
+            } else if (r.type == TEL_LED) {
+                push(&lj, r.jitter_us);
+                push(&lw, r.write_us);
+            } else if (r.type == TEL_END) {
+                s->complete = 1;
+                s->dropped = r.arg;
+                // The total also covers cycles whose record was dropped
+                if (r.underruns > underruns)
+                    underruns = r.underruns;
+                break;
+            }
+            missed += (r.flags & TEL_F_MISSED) != 0;
+        }
+
+        if (only_song && strcmp(s->hdr.song, only_song) != 0)
+            continue;
+
+        s->m[M_AUDIO_MAX] = percentile(&aj, 100);
+        s->m[M_AUDIO_P50] = percentile(&aj, 50);
+        s->m[M_AUDIO_P99] = percentile(&aj, 99);
+        s->m[M_LED_MAX] = percentile(&lj, 100);
+        s->m[M_LED_P50] = percentile(&lj, 50);
+        s->m[M_LED_P99] = percentile(&lj, 99);
+        s->m[M_WRITE_P99] = percentile(&aw, 99);
+        s->m[M_LED_WRITE_P99] = percentile(&lw, 99);
+        s->m[M_MIX_P99] = percentile(&mx, 99);
+        s->m[M_UNDERRUNS] = underruns;
+        s->m[M_MISSED] = missed;
+
+        find_song(session_key(s), 1);
+        session_count++;
+    }
+    free(buf);
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void write_baseline(const char *name) {
+    FILE *f = fopen(name, "w");
+    if (!f) { perror(name); exit(1); }
+
+    static double vals[MAX_SESSIONS];
+    for (int g = 0; g < song_count; ++g) {
+        for (int m = 0; m < M_COUNT; ++m) {
+            int n = 0;
+            for (int i = 0; i < session_count; ++i)
+                if (strcmp(session_key(&sessions[i]), songs[g].song) == 0 &&
+                    sessions[i].complete)
+                    vals[n++] = sessions[i].m[m];
+            if (n == 0)
+                continue;
+            qsort(vals, n, sizeof(double), cmp_double);
+            fprintf(f, "%s %s %.0f\n", songs[g].song, metric_names[m],
+                    vals[n / 2]);
+        }
+    }
+    fclose(f);
+    printf("Baseline for %d songs written to %s\n", song_count, name);
+}
+
+static void read_baseline(const char *name) {
+    FILE *f = fopen(name, "r");
+    if (!f) { perror(name); exit(1); }
+
+    char song[64], metric[64];
+    double v;
+    while (fscanf(f, "%63s %63s %lf", song, metric, &v) == 3) {
+        Song *s = find_song(song, 0);
+        if (!s)
+            continue;
+        for (int m = 0; m < M_COUNT; ++m) {
+            if (strcmp(metric, metric_names[m]) == 0) {
+                s->base[m] = v;
+                s->has_base = 1;
+            }
+        }
+    }
+    fclose(f);
+}
+
+// Worse than the baseline by more than tol, and by more than noise
+static int regressed(int m, double v, double base, double tol) {
+    if (m == M_UNDERRUNS || m == M_MISSED)
+        return v > base;
+    return v > base * (1.0 + tol) && v - base > FLOOR_US;
+}
+
+int main(int argc, char *argv[]) {
+    const char *only_song = NULL, *save = NULL, *compare = NULL;
+    double tol = 0.25;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:w:b:t:")) != -1) {
+        switch (opt) {
+        case 's': only_song = optarg; break;
+        case 'w': save = optarg; break;
+        case 'b': compare = optarg; break;
+        case 't': tol = atof(optarg) / 100.0; break;
+        default:
+            fprintf(stderr, "Usage: %s [-s song] [-w baseline] [-b baseline]"
+                    " [-t pct] file...\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "No telemetry files given\n");
+        return 1;
+    }
+
+    for (int i = optind; i < argc; ++i)
+        load_file(argv[i], only_song);
+
+    printf("%-16s %-16s %-7s %21s %21s %7s %7s %5s %6s\n", "date", "song",
+           "mode", "audio jitter p50/99/max", "LED jitter p50/99/max",
+           "wr p99", "mix p99", "xrun", "missed");
+    for (int i = 0; i < session_count; ++i) {
+        Session *s = &sessions[i];
+        char date[32];
+        time_t t = (time_t)s->hdr.wall_time;
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M", localtime(&t));
+        printf("%-16s %-16.16s %-7s %6.0f/%6.0f/%7.0f %6.0f/%6.0f/%7.0f "
+               "%7.0f %7.0f %5.0f %6.0f%s%s\n",
+               date, s->hdr.song, s->hdr.mode <= TEL_MODE_PWM ? mode_names[s->hdr.mode] : "?",
+               s->m[M_AUDIO_P50], s->m[M_AUDIO_P99], s->m[M_AUDIO_MAX],
+               s->m[M_LED_P50], s->m[M_LED_P99], s->m[M_LED_MAX],
+               s->m[M_WRITE_P99], s->m[M_MIX_P99],
+               s->m[M_UNDERRUNS], s->m[M_MISSED],
+               s->complete ? "" : "  (incomplete)",
+               s->dropped ? "  (records dropped)" : "");
+    }
+
+    if (save)
+        write_baseline(save);
+
+    if (!compare)
+        return 0;
+
+    read_baseline(compare);
+    int regressions = 0;
+    for (int i = 0; i < session_count; ++i) {
+        Session *s = &sessions[i];
+        Song *g = find_song(session_key(s), 0);
+        if (!g || !g->has_base || !s->complete)
+            continue;
+        for (int m = 0; m < M_COUNT; ++m) {
+            if (!regressed(m, s->m[m], g->base[m], tol))
+                continue;
+            char date[32];
+            time_t t = (time_t)s->hdr.wall_time;
+            strftime(date, sizeof(date), "%Y-%m-%d %H:%M", localtime(&t));
+            printf("REGRESSION %s %s: %s %.0f (baseline %.0f)\n",
+                   date, g->song, metric_names[m], s->m[m], g->base[m]);
+            regressions++;
+        }
+    }
+    printf("%d regression%s against %s\n", regressions,
+           regressions == 1 ? "" : "s", compare);
+    return regressions ? 2 : 0;
+}
@@ -0,0 +1,229 @@
+﻿// Converts a .txt duration show into LED cues inside the song's WAV, so
+// the player takes the steps from the audio file at exact samples.
+// Existing "cue " and LIST/adtl chunks are replaced, audio is copied
+// unchanged.
+//
+//   wav-cues [-r] song.wav song.txt [out.wav]
+//
+// Steps land on the authored millisecond positions; -r reproduces the
+// player's .txt timing instead (70 ms minimum, 10 ms rounding). Without
+// out.wav the input file is replaced.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define MAX_STEPS 2048
+
+typedef struct {
+    uint64_t frame;
+    char label[128];
+} Step;
+
+static Step steps[MAX_STEPS];
+static int step_count;
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint8_t *read_file(const char *name, size_t *size) {
+    FILE *f = fopen(name, "rb");
+    if (!f) { perror(name); exit(1); }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    rewind(f);
+    uint8_t *buf = malloc(*size);
+    if (!buf || fread(buf, 1, *size, f) != *size) {
+        fprintf(stderr, "%s: read failed\n", name);
+        exit(1);
+    }
+    fclose(f);
+    return buf;
+}
+
+// Same line format as the player: duration_ms pattern [options] [# ...]
+static uint64_t load_txt(const char *name, uint32_t rate, int rounded) {
+    FILE *f = fopen(name, "r");
+    if (!f) { perror(name); exit(1); }
+
+    char line[256];
+    uint64_t ms = 0;
+    while (fgets(line, sizeof(line), f) && step_count < MAX_STEPS) {
+        char *tok = strtok(line, " \t\r\n");
+        if (!tok) continue;
+        char *end;
+        long dur = strtol(tok, &end, 10);
+        if (end == tok) continue;
+        char *bits = strtok(NULL, " \t\r\n");
+        if (!bits) continue;
+
+        Step *s = &steps[step_count++];
+        s->frame = ms * rate / 1000;
+        snprintf(s->label, sizeof(s->label), "%s", bits);
+
+        char *opt;
+        while ((opt = strtok(NULL, " \t\r\n")) != NULL && opt[0] != '#') {
+            size_t len = strlen(s->label);
+            snprintf(s->label + len, sizeof(s->label) - len, " %s", opt);
+        }
+
+        if (rounded) {
+            if (dur < 70) dur = 70;
+            dur = ((dur + 5) / 10) * 10;
+        }
+        ms += dur;
+    }
+    fclose(f);
+    return ms * rate / 1000;
+}
+
+static void write_chunk(FILE *out, const char *id, const uint8_t *body,
+                        uint32_t size) {
+    uint8_t hdr[8];
+    memcpy(hdr, id, 4);
+    put_u32(hdr + 4, size);
+    fwrite(hdr, 1, 8, out);
+    fwrite(body, 1, size, out);
+    if (size & 1)
+        fputc(0, out);
+}
+
+int main(int argc, char *argv[]) {
+    int rounded = 0, arg = 1;
+    if (arg < argc && strcmp(argv[arg], "-r") == 0) {
+        rounded = 1;
+        arg++;
+    }
+    if (argc - arg < 2) {
+        fprintf(stderr, "Usage: %s [-r] song.wav song.txt [out.wav]\n",
+                argv[0]);
+        return 1;
+    }
+    const char *wav_name = argv[arg], *txt_name = argv[arg + 1];
+    const char *out_name = argc - arg > 2 ? argv[arg + 2] : wav_name;
+
+    size_t size;
+    uint8_t *wav = read_file(wav_name, &size);
+    if (size < 12 || memcmp(wav, "RIFF", 4) || memcmp(wav + 8, "WAVE", 4)) {
+        fprintf(stderr, "%s: not a RIFF/WAVE file\n", wav_name);
+        return 1;
+    }
+
+    // Sample rate and length from fmt / data
+    uint32_t rate = 0, block_align = 0;
+    uint64_t frames = 0;
+    for (size_t p = 12; p + 8 <= size;) {
+        uint32_t len = get_u32(wav + p + 4);
+        if (len > size - p - 8) len = size - p - 8;
+        if (!memcmp(wav + p, "fmt ", 4) && len >= 16) {
+            rate = get_u32(wav + p + 12);
+            block_align = wav[p + 20] | wav[p + 21] << 8;
+        } else if (!memcmp(wav + p, "data", 4) && block_align) {
+            frames = len / block_align;
+        }
+        p += 8 + len + (len & 1);
+    }
+    if (!rate || !frames) {
+        fprintf(stderr, "%s: no fmt/data chunk\n", wav_name);
+        return 1;
+    }
+
+    uint64_t show_end = load_txt(txt_name, rate, rounded);
+    if (step_count == 0) {
+        fprintf(stderr, "%s: no steps\n", txt_name);
+        return 1;
+    }
+    if (steps[0].frame >= frames) {
+        fprintf(stderr, "%s: every step starts past the end of %s\n",
+                txt_name, wav_name);
+        return 1;
+    }
+
+    char tmp_name[512];
+    snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", out_name);
+    FILE *out = fopen(tmp_name, "wb");
+    if (!out) { perror(tmp_name); return 1; }
+
+    fwrite(wav, 1, 12, out);   // RIFF size fixed below
+
+    // Everything but old cues and labels
+    for (size_t p = 12; p + 8 <= size;) {
+        uint32_t len = get_u32(wav + p + 4);
+        if (len > size - p - 8) len = size - p - 8;
+        int old_cues = !memcmp(wav + p, "cue ", 4) ||
+                       (!memcmp(wav + p, "LIST", 4) && len >= 4 &&
+                        !memcmp(wav + p + 8, "adtl", 4));
+        if (!old_cues) {
+            char id[5] = {0};
+            memcpy(id, wav + p, 4);
+            write_chunk(out, id, wav + p + 8, len);
+        }
+        p += 8 + len + (len & 1);
+    }
+
+    // cue: one point per step, sample offset into the data chunk
+    int n = 0;
+    uint32_t cue_size = 4 + 24 * step_count;
+    uint8_t *cue = calloc(1, cue_size);
+    for (int i = 0; i < step_count; ++i) {
+        if (steps[i].frame >= frames)
+            break;
+        uint8_t *c = cue + 4 + 24 * n++;
+        put_u32(c, i + 1);
+        put_u32(c + 4, steps[i].frame);
+        memcpy(c + 8, "data", 4);
+        put_u32(c + 20, steps[i].frame);
+    }
+    put_u32(cue, n);
+    write_chunk(out, "cue ", cue, 4 + 24 * n);
+
+    // LIST/adtl: a labl per cue, an ltxt region ending the last step
+    uint8_t *adtl = malloc(4 + n * (8 + 4 + 128 + 1) + 8 + 20);
+    size_t a = 4;
+    memcpy(adtl, "adtl", 4);
+    for (int i = 0; i < n; ++i) {
+        uint32_t len = 4 + strlen(steps[i].label) + 1;
+        memcpy(adtl + a, "labl", 4);
+        put_u32(adtl + a + 4, len);
+        put_u32(adtl + a + 8, i + 1);
+        memcpy(adtl + a + 12, steps[i].label, len - 4);
+        a += 8 + len;
+        if (len & 1)
+            adtl[a++] = 0;
+    }
+    uint64_t last_end = show_end < frames ? show_end : frames;
+    memcpy(adtl + a, "ltxt", 4);
+    put_u32(adtl + a + 4, 20);
+    memset(adtl + a + 8, 0, 20);
+    put_u32(adtl + a + 8, n);
+    put_u32(adtl + a + 12, last_end - steps[n - 1].frame);
+    memcpy(adtl + a + 16, "rgn ", 4);
+    a += 28;
+    write_chunk(out, "LIST", adtl, a);
+
+    long riff_size = ftell(out) - 8;
+    uint8_t size_le[4];
+    put_u32(size_le, riff_size);
+    fseek(out, 4, SEEK_SET);
+    fwrite(size_le, 1, 4, out);
+
+    if (fclose(out) != 0 || rename(tmp_name, out_name) != 0) {
+        perror(out_name);
+        remove(tmp_name);
+        return 1;
+    }
+
+    printf("%d cues written to %s (%d steps past the audio dropped)\n",
+           n, out_name, step_count - n);
+    printf("Show ends at %.3f s, audio at %.3f s\n",
+           (double)show_end / rate, (double)frames / rate);
+    free(cue);
+    free(adtl);
+    free(wav);
+    return 0;
+}